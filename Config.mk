@@ -72,13 +72,14 @@
 
         MOUNTING=0 # be able to mount multiple file systems
           GETCWD=0 # getcwd(3) syscall-like functionality
-        UPREEMPT=0 # userland preemption
+        UPREEMPT=1 # userland preemption
              MTP=0 # multiple kernel threads per process
          SHADOWD=0 # shadow page cleanup
+            PF2Q=0 # scan-resistant 2Q page cache replacement instead of CLOCK
 
 # Boolean options specified in this specified in this file that should be
 # included as definitions at compile time
-        COMPILE_CONFIG_BOOLS=" DRIVERS VFS S5FS VM FI DYNAMIC MOUNTING MTP SHADOWD GETCWD UPREEMPT "
+        COMPILE_CONFIG_BOOLS=" DRIVERS VFS S5FS VM FI DYNAMIC MOUNTING MTP SHADOWD GETCWD UPREEMPT PF2Q "
 # As above, but not booleans
         COMPILE_CONFIG_DEFS=" NTERMS NDISKS DBG DISK_SIZE BOCHS_INSTALL_DIR "
 
@@ -19,6 +19,7 @@
 #include "mm/tlb.h"
 #include "mm/pagetable.h"
 #include "mm/kmalloc.h"
+#include "mm/pframe.h"
 
 #include "vm/vmmap.h"
 
@@ -108,6 +109,9 @@ static int _elf32_map_segment(vmmap_t *map, vnode_t *file, int32_t memoff, const
                                                 0, NULL))) {
                         return ret;
                 }
+                /* the program is about to fault all of this in; start
+                 * reading it now rather than one fault at a time */
+                pframe_prefetch(&file->vn_mmobj, ADDR_TO_PN(fileoff), npages);
         }
 
         if (memsz > filesz) {
@@ -20,11 +20,13 @@
 
 #include "proc/proc.h"
 #include "proc/kthread.h"
+#include "proc/sched.h"
 
 #include "util/init.h"
 #include "util/string.h"
 #include "util/debug.h"
 #include "util/list.h"
+#include "util/time.h"
 
 #include "mm/mman.h"
 #include "mm/mm.h"
@@ -670,6 +672,23 @@ err:
         return -1;
 }
 
+/*
+ * Sleeps for the given number of milliseconds. Returns 0 once they have
+ * passed, or the number of milliseconds left if the sleep was cancelled.
+ */
+static int sys_sleep(uint32_t msecs)
+{
+        ktqueue_t q;
+        uint32_t ticks = msecs_to_jiffies(msecs);
+
+        if (0 == ticks)
+                return 0;
+        sched_queue_init(&q);
+        if (sched_cancellable_sleep_on_timeout(&q, &ticks) < 0)
+                return jiffies_to_msecs(ticks);
+        return 0;
+}
+
 static int sys_fork(regs_t *regs)
 {
         int ret = do_fork(regs);
@@ -834,6 +853,9 @@ static int syscall_dispatch(uint32_t sysnum, uint32_t args, regs_t *regs)
                 case SYS_getpid:
                         return curproc->p_pid;
 
+                case SYS_sleep:
+                        return sys_sleep((uint32_t)args);
+
                 case SYS_sync:
                         sys_sync();
                         return 0;
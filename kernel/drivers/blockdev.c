@@ -15,6 +15,7 @@
 #include "types.h"
 #include "util/debug.h"
 #include "util/list.h"
+#include "util/string.h"
 
 #include "drivers/blockdev.h"
 #include "drivers/disk/ata.h"
@@ -27,8 +28,10 @@ static void blockdev_put(mmobj_t *o);
 static int blockdev_lookuppage(mmobj_t *o, uint32_t pagenum,
                                int forwrite, pframe_t **pf);
 static int blockdev_fillpage(mmobj_t *o, pframe_t *pf);
+static int blockdev_fillpages(mmobj_t *o, pframe_t **pfs, int npages);
 static int blockdev_dirtypage(mmobj_t *o, pframe_t *pf);
 static int blockdev_cleanpage(mmobj_t *o, pframe_t *pf);
+static int blockdev_cleanpages(mmobj_t *o, pframe_t **pfs, int npages);
 
 static mmobj_ops_t blockdev_mmobj_ops = {
         .ref = blockdev_ref,
@@ -36,7 +39,9 @@ static mmobj_ops_t blockdev_mmobj_ops = {
         .lookuppage = blockdev_lookuppage,
         .fillpage = blockdev_fillpage,
         .dirtypage = blockdev_dirtypage,
-        .cleanpage = blockdev_cleanpage
+        .cleanpage = blockdev_cleanpage,
+        .fillpages = blockdev_fillpages,
+        .cleanpages = blockdev_cleanpages
 };
 
 static list_t blockdevs;
@@ -138,6 +143,32 @@ blockdev_fillpage(mmobj_t *o, pframe_t *pf)
         return bd->bd_ops->read_block(bd, pf->pf_addr, pf->pf_pagenum, 1);
 }
 
+/* As with blockdev_cleanpages, read all of the blocks into one bounce
+ * buffer with a single request, then copy them out into the pages. */
+static int
+blockdev_fillpages(mmobj_t *o, pframe_t **pfs, int npages)
+{
+        KASSERT(npages > 0 && pfs[0]->pf_obj == o);
+        blockdev_t *bd = CONTAINER_OF(o, blockdev_t, bd_mmobj);
+        char *buf;
+        int i, ret = 0;
+
+        if (NULL != (buf = page_alloc_n(npages))) {
+                if (0 == (ret = bd->bd_ops->read_block(bd, buf, pfs[0]->pf_pagenum, npages))) {
+                        for (i = 0; i < npages; ++i) {
+                                KASSERT(pfs[i]->pf_pagenum == pfs[0]->pf_pagenum + i);
+                                memcpy(pfs[i]->pf_addr, buf + i * BLOCK_SIZE, BLOCK_SIZE);
+                        }
+                }
+                page_free_n(buf, npages);
+                return ret;
+        }
+
+        for (i = 0; i < npages && 0 == ret; ++i)
+                ret = blockdev_fillpage(o, pfs[i]);
+        return ret;
+}
+
 /* block devices don't need to make use of this entry point: */
 static int
 blockdev_dirtypage(mmobj_t *o, pframe_t *pf)
@@ -154,3 +185,30 @@ blockdev_cleanpage(mmobj_t *o, pframe_t *pf)
         /* Clean the corresponding page by writing it back */
         return bd->bd_ops->write_block(bd, pf->pf_addr, pf->pf_pagenum, 1);
 }
+
+/* The pages are scattered in memory, but write_block wants one buffer, so
+ * gather them into a bounce buffer and write them with a single request.
+ * If memory is too tight for that (which is likely when we are called on
+ * behalf of pageoutd), fall back to one request per page. */
+static int
+blockdev_cleanpages(mmobj_t *o, pframe_t **pfs, int npages)
+{
+        KASSERT(npages > 0 && pfs[0]->pf_obj == o);
+        blockdev_t *bd = CONTAINER_OF(o, blockdev_t, bd_mmobj);
+        char *buf;
+        int i, ret = 0;
+
+        if (NULL != (buf = page_alloc_n(npages))) {
+                for (i = 0; i < npages; ++i) {
+                        KASSERT(pfs[i]->pf_pagenum == pfs[0]->pf_pagenum + i);
+                        memcpy(buf + i * BLOCK_SIZE, pfs[i]->pf_addr, BLOCK_SIZE);
+                }
+                ret = bd->bd_ops->write_block(bd, buf, pfs[0]->pf_pagenum, npages);
+                page_free_n(buf, npages);
+                return ret;
+        }
+
+        for (i = 0; i < npages && 0 == ret; ++i)
+                ret = blockdev_cleanpage(o, pfs[i]);
+        return ret;
+}
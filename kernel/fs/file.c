@@ -37,7 +37,7 @@ static slab_allocator_t *file_allocator;
 static __attribute__((unused)) void
 file_init(void)
 {
-        file_allocator = slab_allocator_create("file", sizeof(file_t));
+        file_allocator = slab_allocator_create("file", sizeof(file_t), 0, NULL, NULL);
 }
 init_func(file_init);
 
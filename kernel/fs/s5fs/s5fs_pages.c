@@ -0,0 +1,163 @@
+/******************************************************************************/
+/* Important Spring 2015 CSCI 402 usage information:                          */
+/*                                                                            */
+/* This fils is part of CSCI 402 kernel programming assignments at USC.       */
+/* Please understand that you are NOT permitted to distribute or publically   */
+/*         display a copy of this file (or ANY PART of it) for any reason.    */
+/* If anyone (including your prospective employer) asks you to post the code, */
+/*         you must inform them that you do NOT have permissions to do so.    */
+/* You are also NOT permitted to remove or alter this comment block.          */
+/* If this comment block is removed or altered in a submitted file, 20 points */
+/*         will be deducted.                                                  */
+/******************************************************************************/
+
+#include "globals.h"
+#include "kernel.h"
+#include "errno.h"
+
+#include "util/debug.h"
+#include "util/string.h"
+
+#include "mm/page.h"
+#include "mm/pframe.h"
+
+#include "fs/vnode.h"
+#include "fs/s5fs/s5fs.h"
+#include "fs/s5fs/s5fs_subr.h"
+
+/*
+ * Clustered page I/O for s5fs files. The prebuilt file system moves each
+ * page of a file with a request of its own. These map a run of
+ * consecutive pages of a file to their disk blocks with s5_seek_to_block
+ * and issue one request for each stretch of the run which is consecutive
+ * on disk as well, through a bounce buffer, since the pages themselves
+ * are scattered in memory. A file block is a page (S5_BLOCK_SIZE).
+ */
+#define S5FS_MAX_RUN            MAX(PF_READAHEAD_MAX, PF_CLEAN_CLUSTER)
+
+/*
+ * Looks up the disk blocks of the npages pages in pfs, 0 for a sparse
+ * block.
+ *
+ * @return 0 on success, -errno on failure
+ */
+static int
+s5fs_map_run(vnode_t *vnode, pframe_t **pfs, int npages, int *blocks)
+{
+        int i, ret;
+
+        for (i = 0; i < npages; ++i) {
+                ret = s5_seek_to_block(vnode, (off_t) PN_TO_ADDR(pfs[i]->pf_pagenum), 0);
+                if (0 > ret)
+                        return ret;
+                blocks[i] = ret;
+        }
+        return 0;
+}
+
+/*
+ * Returns the number of pages, starting with page i, which are stored in
+ * consecutive blocks on disk; a sparse page stands alone.
+ */
+static int
+s5fs_stretch(int *blocks, int i, int npages)
+{
+        int n = 1;
+
+        while (0 != blocks[i] && i + n < npages && blocks[i + n] == blocks[i] + n)
+                n++;
+        return n;
+}
+
+/*
+ * Reads the n consecutive blocks starting at blk into the pages in pfs
+ * with one request, or with one request per page if there is no memory
+ * for the bounce buffer.
+ */
+static int
+s5fs_read_stretch(blockdev_t *bd, pframe_t **pfs, int blk, int n)
+{
+        char *buf;
+        int i, ret = 0;
+
+        if (1 < n && NULL != (buf = page_alloc_n(n))) {
+                if (0 == (ret = bd->bd_ops->read_block(bd, buf, blk, n))) {
+                        for (i = 0; i < n; ++i)
+                                memcpy(pfs[i]->pf_addr, buf + i * S5_BLOCK_SIZE, S5_BLOCK_SIZE);
+                }
+                page_free_n(buf, n);
+                return ret;
+        }
+
+        for (i = 0; i < n && 0 == ret; ++i)
+                ret = bd->bd_ops->read_block(bd, pfs[i]->pf_addr, blk + i, 1);
+        return ret;
+}
+
+/*
+ * Writes the pages in pfs to the n consecutive blocks starting at blk
+ * with one request, or with one request per page if there is no memory
+ * for the bounce buffer.
+ */
+static int
+s5fs_write_stretch(blockdev_t *bd, pframe_t **pfs, int blk, int n)
+{
+        char *buf;
+        int i, ret = 0;
+
+        if (1 < n && NULL != (buf = page_alloc_n(n))) {
+                for (i = 0; i < n; ++i)
+                        memcpy(buf + i * S5_BLOCK_SIZE, pfs[i]->pf_addr, S5_BLOCK_SIZE);
+                ret = bd->bd_ops->write_block(bd, buf, blk, n);
+                page_free_n(buf, n);
+                return ret;
+        }
+
+        for (i = 0; i < n && 0 == ret; ++i)
+                ret = bd->bd_ops->write_block(bd, pfs[i]->pf_addr, blk + i, 1);
+        return ret;
+}
+
+int
+s5fs_fillpages(vnode_t *vnode, pframe_t **pfs, int npages)
+{
+        blockdev_t *bd = VNODE_TO_S5FS(vnode)->s5f_bdev;
+        int blocks[S5FS_MAX_RUN];
+        int i, n, ret;
+
+        KASSERT(0 < npages && npages <= S5FS_MAX_RUN);
+        if (0 > (ret = s5fs_map_run(vnode, pfs, npages, blocks)))
+                return ret;
+
+        for (i = 0; i < npages; i += n) {
+                n = s5fs_stretch(blocks, i, npages);
+                if (0 == blocks[i]) {
+                        /* sparse, reads as zeros */
+                        memset(pfs[i]->pf_addr, 0, S5_BLOCK_SIZE);
+                } else if (0 > (ret = s5fs_read_stretch(bd, pfs + i, blocks[i], n))) {
+                        return ret;
+                }
+        }
+        return 0;
+}
+
+int
+s5fs_cleanpages(vnode_t *vnode, pframe_t **pfs, int npages)
+{
+        blockdev_t *bd = VNODE_TO_S5FS(vnode)->s5f_bdev;
+        int blocks[S5FS_MAX_RUN];
+        int i, n, ret;
+
+        KASSERT(0 < npages && npages <= S5FS_MAX_RUN);
+        if (0 > (ret = s5fs_map_run(vnode, pfs, npages, blocks)))
+                return ret;
+
+        for (i = 0; i < npages; i += n) {
+                /* dirtypage allocated the block of every dirty page */
+                KASSERT(0 != blocks[i]);
+                n = s5fs_stretch(blocks, i, npages);
+                if (0 > (ret = s5fs_write_stretch(bd, pfs + i, blocks[i], n)))
+                        return ret;
+        }
+        return 0;
+}
@@ -26,6 +26,7 @@
 #include "fs/stat.h"
 #include "fs/vfs.h"
 #include "fs/vnode.h"
+#include "fs/s5fs/s5fs.h"
 #include "mm/slab.h"
 #include "proc/sched.h"
 #include "util/debug.h"
@@ -51,8 +52,10 @@ static void vo_vput(mmobj_t *o);
 
 static int  vlookuppage(mmobj_t *o, uint32_t pagenum, int forwrite, pframe_t **pf);
 static int  vreadpage(mmobj_t *o, pframe_t *pf);
+static int  vreadpages(mmobj_t *o, pframe_t **pfs, int npages);
 static int  vdirtypage(mmobj_t *o, pframe_t *pf);
 static int  vcleanpage(mmobj_t *o, pframe_t *pf);
+static int  vcleanpages(mmobj_t *o, pframe_t **pfs, int npages);
 
 static mmobj_ops_t vnode_mmobj_ops = {
         .ref = vo_vref,
@@ -60,7 +63,9 @@ static mmobj_ops_t vnode_mmobj_ops = {
         .lookuppage = vlookuppage,
         .fillpage = vreadpage,
         .dirtypage = vdirtypage,
-        .cleanpage = vcleanpage
+        .cleanpage = vcleanpage,
+        .fillpages = vreadpages,
+        .cleanpages = vcleanpages
 };
 
 /* vnode operations tables for special files: */
@@ -103,11 +108,28 @@ static vnode_ops_t blockdev_spec_vops = {
 /*
  * Initialization:
  */
+
+/*
+ * Slab constructor. vput frees a vnode with its mutex unlocked, nobody on
+ * its wait queue, and no references or resident pages, so these members
+ * keep their initial values from one use of the vnode to the next.
+ */
+static void
+vnode_ctor(void *obj)
+{
+        vnode_t *vn = obj;
+        memset(vn, 0, sizeof(vnode_t));
+        kmutex_init(&vn->vn_mutex);
+        mmobj_init(&vn->vn_mmobj, &vnode_mmobj_ops);
+        sched_queue_init(&vn->vn_waitq);
+}
+
 static __attribute__((unused)) void
 vnode_init(void)
 {
         list_init(&vnode_inuse_list);
-        vnode_allocator = slab_allocator_create("vnode", sizeof(vnode_t));
+        vnode_allocator = slab_allocator_create("vnode", sizeof(vnode_t),
+                                                SLAB_CACHE_LINE, vnode_ctor, NULL);
 }
 init_func(vnode_init);
 
@@ -173,14 +195,22 @@ find:
                 sched_switch();
                 goto find;
         }
-        memset(vn, 0, sizeof(vnode_t));
-        /*   initialize its contents: */
+        /*   initialize its contents (the mutex, mmobj and wait queue
+         *   are still as vnode_ctor left them): */
+        KASSERT(NULL == vn->vn_mutex.km_holder);
+        KASSERT(0 == vn->vn_refcount && 0 == vn->vn_nrespages);
+        KASSERT(sched_queue_empty(&vn->vn_waitq));
         /*     members that can be initialized here: */
+        vn->vn_ops = NULL;
         vn->vn_fs = fs;
         vn->vn_vno = vno;
-        kmutex_init(&vn->vn_mutex);
-        mmobj_init(&vn->vn_mmobj, &vnode_mmobj_ops);
-        sched_queue_init(&vn->vn_waitq);
+        vn->vn_mode = 0;
+        vn->vn_len = 0;
+        vn->vn_i = NULL;
+        vn->vn_devid = 0;
+        vn->vn_cdev = NULL;
+        vn->vn_bdev = NULL;
+        vn->vn_flags = 0;
 
 #ifdef __MOUNTING__
         vn->vn_mount = vn;
@@ -598,6 +628,38 @@ vreadpage(mmobj_t *o, pframe_t *pf)
         return v->vn_ops->fillpage(v, (int)PN_TO_ADDR(pf->pf_pagenum), pf->pf_addr);
 }
 
+/*
+ * Files and directories of an s5fs are read and written back a run of
+ * pages at a time (see fs/s5fs/s5fs_pages.c); other file systems are only
+ * asked for one page at a time. Readahead does not know where the file ends, so pages past
+ * the end of a regular file are just zero-filled rather than handed to
+ * the file system.
+ */
+#define vnode_is_s5fs_data(v) \
+        ((S_ISREG((v)->vn_mode) || S_ISDIR((v)->vn_mode)) \
+         && 0 == strcmp((v)->vn_fs->fs_type, "s5fs"))
+
+static int
+vreadpages(mmobj_t *o, pframe_t **pfs, int npages)
+{
+        KASSERT(NULL != pfs);
+        KASSERT(NULL != o);
+
+        vnode_t *v = mmobj_to_vnode(o);
+        int i, ret = 0;
+
+        while (0 < npages && S_ISREG(v->vn_mode)
+               && (uint32_t) v->vn_len <= pfs[npages - 1]->pf_pagenum * PAGE_SIZE) {
+                memset(pfs[--npages]->pf_addr, 0, PAGE_SIZE);
+        }
+        if (0 < npages && vnode_is_s5fs_data(v))
+                return s5fs_fillpages(v, pfs, npages);
+
+        for (i = 0; i < npages && 0 == ret; ++i)
+                ret = vreadpage(o, pfs[i]);
+        return ret;
+}
+
 static int
 vdirtypage(mmobj_t *o, pframe_t *pf)
 {
@@ -621,3 +683,20 @@ vcleanpage(mmobj_t *o, pframe_t *pf)
         vnode_t *v = mmobj_to_vnode(o);
         return v->vn_ops->cleanpage(v, (int) PN_TO_ADDR(pf->pf_pagenum), pf->pf_addr);
 }
+
+static int
+vcleanpages(mmobj_t *o, pframe_t **pfs, int npages)
+{
+        KASSERT(NULL != pfs);
+        KASSERT(NULL != o);
+
+        vnode_t *v = mmobj_to_vnode(o);
+        int i, ret = 0;
+
+        if (vnode_is_s5fs_data(v))
+                return s5fs_cleanpages(v, pfs, npages);
+
+        for (i = 0; i < npages && 0 == ret; ++i)
+                ret = vcleanpage(o, pfs[i]);
+        return ret;
+}
@@ -38,7 +38,7 @@
 #define SYS_unlink              9
 #define SYS_execve              10
 #define SYS_chdir               11
-#define SYS_sleep               12 /* NYI */
+#define SYS_sleep               12
 #define SYS_lseek               14
 #define SYS_sync                15
 #define SYS_nuke                16 /* NYI */
@@ -25,7 +25,11 @@
  * kernel configuration parameters
  */
 #define DEFAULT_STACK_SIZE      (56*1024) /* size of stacks */
+#define KTHREAD_STACK_CACHE     4         /* stacks of dead threads kept for reuse */
 #define TICK_MSECS              10        /* msecs between clock interrupts */
+#define SCHED_TIMESLICE         5         /* clock ticks a thread runs before preemption */
+#define SCHED_WAKE_BOOST        1         /* levels a thread woken from sleep is raised by */
+#define SMP_MAX_CPUS            16        /* processors the kernel keeps track of */
 
 /*
  * Memory-management-related:
@@ -38,10 +42,26 @@
 #define KMEM_FRAC(x)               (((x)>>2)+((x)>>3)) /* 37.5%-ish */
 
 /*     pframe/mmobj-system-related: */
-#define PF_HASH_SIZE                  17 /* Number of buckets in pn/mmobj->pframe hash */
-/*         Pageout-related: */
-#define PAGEOUTD_FREE_TARGET_SHIFT     5 /* 3.125% */
-#define PAGEOUTD_FREE_MIN_SHIFT        4 /* 6.25% */
+#define PAGE_COMPACT_TRIES             4 /* Blocks tried per compaction */
+#define PAGE_HOT_CACHE                32 /* Free single pages cached for page_alloc */
+#define PAGE_HOT_BATCH                 8 /* Pages moved to/from the buddy lists at once */
+#define PAGE_ZERO_POOL                32 /* Free pages kept zeroed by the idle loop */
+#define PAGE_SHRINK_BATCH             32 /* Fewest pages asked of the shrinkers at once */
+#define PF_TREE_SHIFT                  6 /* log2 of fan-out of per-mmobj resident page tree */
+#define PF_OBJ_BUCKETS               256 /* Buckets in the hash of resident page trees */
+/*         2Q-related (only with PF2Q=1 in Config.mk): */
+#define PF_2Q_KIN_SHIFT                2 /* probationary list kept to 25% of cache */
+#define PF_2Q_NGHOSTS                256 /* Evicted pages remembered */
+#define PF_2Q_GHOST_BUCKETS           64 /* Buckets in the ghost hash */
+#define PF_CLEAN_CLUSTER               8 /* Max dirty pages written back per request */
+#define PF_READAHEAD_MIN               4 /* First readahead window, in pages */
+#define PF_READAHEAD_MAX              16 /* Largest readahead window, in pages */
+#define PF_FILL_QUEUE                 64 /* Max pages queued for background fill */
+#define PF_TLB_FLUSH_MAX              32 /* Larger invalidations flush the whole TLB */
+/*         Pageout-related (fractions of the pages free at boot): */
+#define PAGEOUTD_FREE_TARGET_SHIFT     4 /* 6.25%, pageoutd stops here ("high") */
+#define PAGEOUTD_FREE_MIN_SHIFT        5 /* 3.125%, allocations block here ("min") */
+/*         pageoutd starts in the background halfway between the two ("low") */
 
 
 /*
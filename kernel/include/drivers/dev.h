@@ -54,9 +54,11 @@
 #define NULL_DEVID              (MKDEVID(0, 0))
 #define MEM_NULL_DEVID          (MKDEVID(1, 0))
 #define MEM_ZERO_DEVID          (MKDEVID(1, 1))
+#define MEM_SLABINFO_DEVID      (MKDEVID(1, 2))
 
 #define DISK_MAJOR 1
 
 #define MEM_MAJOR       1
 #define MEM_NULL_MINOR  0
 #define MEM_ZERO_MINOR  1
+#define MEM_SLABINFO_MINOR 2
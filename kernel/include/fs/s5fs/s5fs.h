@@ -126,4 +126,10 @@ typedef struct s5fs {
 } s5fs_t;
 
 int s5fs_mount(struct fs *fs);
+
+/* Fill or write back a run of pages of a file, see the fillpages and
+ * cleanpages mmobj entry points */
+struct pframe;
+int s5fs_fillpages(struct vnode *vnode, struct pframe **pfs, int npages);
+int s5fs_cleanpages(struct vnode *vnode, struct pframe **pfs, int npages);
 #endif
@@ -20,10 +20,14 @@
  * function. */
 void apic_init();
 
+/* Returns the id of the local APIC of the processor we are
+ * running on. */
+uint32_t apic_current_id();
+
 /* Maps the given IRQ to the given interrupt number. */
 void apic_setredir(uint32_t irq, uint8_t intr);
 
-/* Starts the APIC timer */
+/* Starts the APIC timer interrupting freq times a second */
 void apic_enable_periodic_timer(uint32_t freq);
 
 /* Stops the APIC timer */
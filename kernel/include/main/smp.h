@@ -0,0 +1,52 @@
+/******************************************************************************/
+/* Important Spring 2015 CSCI 402 usage information:                          */
+/*                                                                            */
+/* This fils is part of CSCI 402 kernel programming assignments at USC.       */
+/* Please understand that you are NOT permitted to distribute or publically   */
+/*         display a copy of this file (or ANY PART of it) for any reason.    */
+/* If anyone (including your prospective employer) asks you to post the code, */
+/*         you must inform them that you do NOT have permissions to do so.    */
+/* You are also NOT permitted to remove or alter this comment block.          */
+/* If this comment block is removed or altered in a submitted file, 20 points */
+/*         will be deducted.                                                  */
+/******************************************************************************/
+
+#pragma once
+
+#include "types.h"
+
+/*
+ * The processors the ACPI tables list. Only the boot processor, which is
+ * always cpu 0, runs kernel code: the others are recorded by apic_init
+ * and left waiting for a startup IPI.
+ */
+typedef struct cpu {
+        int             cpu_id;         /* index in the table, 0 is the boot processor */
+        uint32_t        cpu_apicid;     /* id of its local APIC */
+        int             cpu_online;     /* 1 once it runs kernel code */
+} cpu_t;
+
+/**
+ * Records a processor found in the ACPI tables. Processors beyond
+ * SMP_MAX_CPUS are ignored.
+ *
+ * @param apicid the id of the processor's local APIC
+ * @param boot nonzero if it is the processor we are running on
+ */
+void smp_add_cpu(uint32_t apicid, int boot);
+
+/**
+ * @return the number of processors recorded, at least 1
+ */
+int smp_ncpus(void);
+
+/**
+ * @param id a cpu_id less than smp_ncpus()
+ * @return the processor with the given id
+ */
+cpu_t *smp_cpu(int id);
+
+/**
+ * @return the processor we are running on
+ */
+cpu_t *smp_self(void);
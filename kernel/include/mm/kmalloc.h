@@ -17,3 +17,5 @@
 
 void *kmalloc(size_t size);
 void  kfree(void *addr);
+
+size_t kmalloc_info(const void *arg, char *buf, size_t size);
@@ -16,6 +16,7 @@
 #include "util/list.h"
 
 struct pframe;
+struct vmarea;
 typedef struct mmobj_ops mmobj_ops_t;
 
 typedef struct mmobj {
@@ -27,16 +28,20 @@ typedef struct mmobj {
          * modify these, but others may read/access them:
          */
         int                 mmo_nrespages;
-        list_t              mmo_respages;
+        list_t              mmo_respages;   /* kept sorted by pf_pagenum */
         /*
          * For shadow objects, the mmo_bottom_obj member of the union should point
          * to the bottommost object in the shadow chain. For non-shadow objects, the
-         * mmo_vmas member of the union, should be a list of all vm_areas that
+         * mmo_vmas member of the union, should be the root of the reverse map
+         * (an interval tree, see vmarea_rmap_insert) of all vm_areas that
          * have this object at the bottom of their tree of mmobjs.
          */
         union {
-                list_t            mmo_vmas;
+                struct vmarea    *mmo_vmas;
                 struct mmobj     *mmo_bottom_obj;
+                list_t            mmo_unused;   /* keeps the union at the size
+                                                 * the prebuilt drivers and
+                                                 * file system expect */
         }                   mmo_un;
 
         /*
@@ -99,6 +104,35 @@ struct mmobj_ops {
          * Return 0 on success and -errno otherwise.
          */
         int (*cleanpage)(mmobj_t *o, struct pframe *pf);
+
+        /*
+         * The entry points below are newer than the prebuilt drivers and
+         * file system, so they are kept at the end to leave the offsets of
+         * the ones above as those objects expect them.
+         */
+
+        /*
+         * Optional; may be NULL. Like fillpage, but fills the npages pages
+         * in pfs, which all belong to 'o' and have consecutive page numbers
+         * starting at pfs[0]->pf_pagenum, in as few requests to the backing
+         * store as possible. Objects which provide this get sequential
+         * readahead (see pframe_get).
+         * This may block.
+         * Return 0 on success and -errno otherwise; on failure none of the
+         * pages may be considered filled.
+         */
+        int (*fillpages)(mmobj_t *o, struct pframe **pfs, int npages);
+
+        /*
+         * Optional; may be NULL. Like cleanpage, but writes back the npages
+         * pages in pfs, which all belong to 'o' and have consecutive page
+         * numbers starting at pfs[0]->pf_pagenum, in as few requests to
+         * the backing store as possible.
+         * This may block.
+         * Return 0 on success and -errno otherwise; on failure none of the
+         * pages may be considered clean.
+         */
+        int (*cleanpages)(mmobj_t *o, struct pframe **pfs, int npages);
 };
 
 
@@ -112,7 +146,7 @@ static inline void mmobj_init(mmobj_t *o, mmobj_ops_t *ops)
         (o)->mmo_refcount = 0;
         (o)->mmo_nrespages = 0;
         list_init(&(o)->mmo_respages);
-        list_init(&(o)->mmo_un.mmo_vmas);
+        (o)->mmo_un.mmo_vmas = NULL;
         (o)->mmo_shadowed = NULL;
 }
 
@@ -121,5 +155,5 @@ static inline void mmobj_init(mmobj_t *o, mmobj_ops_t *ops)
          (o):((o)->mmo_un.mmo_bottom_obj))
 
 #define mmobj_bottom_vmas(o) \
-        ((list_t *)(&(mmobj_bottom_obj(o))->mmo_un.mmo_vmas))
+        ((struct vmarea **)(&(mmobj_bottom_obj(o))->mmo_un.mmo_vmas))
 
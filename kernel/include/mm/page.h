@@ -61,7 +61,19 @@ void  page_free(void *addr);
 void *page_alloc_n(uint32_t npages);
 void  page_free_n(void *start, uint32_t npages);
 
+/* Allocates one page filled with zeroes, taken from the
+ * pool of pages zeroed while the CPU was idle if there is
+ * one ready. Free it with page_free. */
+void *page_alloc_zeroed(void);
+
+/* Zeroes one free page into the pool, called from the idle
+ * loop. Returns nonzero if a page was zeroed, zero if the
+ * pool is full or there is no free page to zero. */
+int   page_zero_idle(void);
+
 /* Returns the number of free pages remaining in the
  * system. Note that calls to page_alloc_n(npages) may
  * fail even if page_free_count() >= npages. */
 uint32_t page_free_count();
+
+size_t page_info(const void *arg, char *buf, size_t size);
@@ -67,6 +67,14 @@ int pt_map(pagedir_t *pd, uintptr_t vaddr, uintptr_t paddr, uint32_t pdflags, ui
  * be page aligned. Note that the TLB is not flushed by this function. */
 void pt_unmap(pagedir_t *pd, uintptr_t vaddr);
 
+/* Returns 1 if the page for the given virtual page in the given page
+ * directory maps the physical page paddr and has been accessed since this
+ * was last called, 0 otherwise, and clears the entry's accessed bit. vaddr
+ * must be in the user address space. Note that the TLB is not flushed by
+ * this function; the processor will not set the bit again while it still
+ * caches the entry. */
+int pt_test_and_clear_accessed(pagedir_t *pd, uintptr_t vaddr, uintptr_t paddr);
+
 /* Unmaps the given range of addresses [low, high). As with pt_unmap,
  * the addresses must be page aligned in the user address space */
 void pt_unmap_range(pagedir_t *pd, uintptr_t vlow, uintptr_t vhigh);
@@ -24,6 +24,9 @@ struct mmobj;
 
 #define PF_BUSY                 0x01
 #define PF_DIRTY                0x02
+#define PF_REFERENCED           0x04
+#define PF_PROTECTED            0x08
+#define PF_READAHEAD            0x10
 
 #define pframe_is_busy(pf)          ((pf)->pf_flags & PF_BUSY)
 #define pframe_set_busy(pf)         do { (pf)->pf_flags |= PF_BUSY; } while (0)
@@ -33,6 +36,10 @@ struct mmobj;
 #define pframe_set_dirty(pf)        do { (pf)->pf_flags |= PF_DIRTY; } while (0)
 #define pframe_clear_dirty(pf)      do { (pf)->pf_flags &= ~PF_DIRTY; } while (0)
 
+#define pframe_is_referenced(pf)    ((pf)->pf_flags & PF_REFERENCED)
+#define pframe_set_referenced(pf)   do { (pf)->pf_flags |= PF_REFERENCED; } while (0)
+#define pframe_clear_referenced(pf) do { (pf)->pf_flags &= ~PF_REFERENCED; } while (0)
+
 #define pframe_is_pinned(pf)        ((pf)->pf_pincount)
 #define pframe_is_free(pf)          (!(pf)->pf_obj)
 
@@ -51,11 +58,13 @@ typedef struct pframe {
         void               *pf_addr;
 
         /* Private: */
-        uint8_t             pf_flags;    /* PF_DIRTY, PF_BUSY */
+        uint8_t             pf_flags;    /* PF_DIRTY, PF_BUSY, PF_REFERENCED,
+                                          * PF_PROTECTED, PF_READAHEAD */
         ktqueue_t           pf_waitq;    /* wait on this if page is busy */
         int                 pf_pincount;
         list_link_t         pf_link;     /* link on {free,allocated,pinned}_list */
-        list_link_t         pf_hlink;    /* link on hash chain of resident page hash */
+        list_link_t         pf_hlink;    /* unused, keeps the layout the prebuilt
+                                          * drivers and file system expect */
         list_link_t         pf_olink;    /* link on object's list of resident pages */
 } pframe_t;
 
@@ -68,8 +77,10 @@ void pframe_shutdown(void);
 pframe_t *pframe_get_resident(struct mmobj *o, uint32_t pagenum);
 
 int pframe_lookup(struct mmobj *o, uint32_t pagenum, int forwrite, pframe_t **result);
-void pframe_migrate(pframe_t *pf, mmobj_t *dest);
+int  pframe_migrate(pframe_t *pf, mmobj_t *dest);
 int pframe_get(struct mmobj *o, uint32_t pagenum, pframe_t **result);
+int pframe_prefetch(struct mmobj *o, uint32_t pagenum, uint32_t npages);
+int pframe_evacuate(uintptr_t lo, uintptr_t hi, int move);
 
 void pframe_pin(pframe_t *pf);
 void pframe_unpin(pframe_t *pf);
@@ -81,3 +92,5 @@ void pframe_free(pframe_t *pf);
 void pframe_clean_all(void);
 
 void pframe_remove_from_pts(pframe_t *pf);
+
+size_t pframe_info(const void *arg, char *buf, size_t osize);
@@ -0,0 +1,51 @@
+/******************************************************************************/
+/* Important Spring 2015 CSCI 402 usage information:                          */
+/*                                                                            */
+/* This fils is part of CSCI 402 kernel programming assignments at USC.       */
+/* Please understand that you are NOT permitted to distribute or publically   */
+/*         display a copy of this file (or ANY PART of it) for any reason.    */
+/* If anyone (including your prospective employer) asks you to post the code, */
+/*         you must inform them that you do NOT have permissions to do so.    */
+/* You are also NOT permitted to remove or alter this comment block.          */
+/* If this comment block is removed or altered in a submitted file, 20 points */
+/*         will be deducted.                                                  */
+/******************************************************************************/
+
+#pragma once
+
+/*
+ * Shrinkers let subsystems that keep memory cached give it back when
+ * pages run short. Each registers a count callback, giving the number of
+ * pages it could free, and a scan callback, asked to free some number of
+ * pages and returning how many it did. Both are called from inside the
+ * page allocator, so they must not block or allocate memory.
+ */
+
+#include "types.h"
+
+#include "util/list.h"
+
+typedef struct shrinker {
+        const char  *sh_name;
+        uint32_t   (*sh_count)(struct shrinker *sh);
+        uint32_t   (*sh_scan)(struct shrinker *sh, uint32_t npages);
+
+        uint32_t     sh_calls;          /* times sh_scan was called */
+        uint32_t     sh_freed;          /* pages it freed in total */
+        list_link_t  sh_link;           /* link on the list of shrinkers */
+} shrinker_t;
+
+void shrinker_register(shrinker_t *sh);
+void shrinker_unregister(shrinker_t *sh);
+
+/*
+ * Asks every shrinker to free part of target pages, in proportion to how
+ * many it can free. Pages reclaimable elsewhere (npages_other) take their
+ * share of the target too, so callers with their own reclaim can let the
+ * shrinkers carry only part of the pressure.
+ *
+ * @return the number of pages freed
+ */
+uint32_t shrink_caches(uint32_t target, uint32_t npages_other);
+
+size_t shrinker_info(const void *arg, char *buf, size_t size);
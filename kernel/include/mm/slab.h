@@ -32,8 +32,27 @@
  */
 typedef struct slab_allocator slab_allocator_t;
 
-slab_allocator_t *slab_allocator_create(const char *name, size_t size);
+/*
+ * A constructor is run on each object when its slab is created and a
+ * destructor when the slab is freed, so objects come out of
+ * slab_obj_alloc() constructed and must be put back in that state before
+ * slab_obj_free(). Either may be NULL.
+ */
+typedef void (*slab_ctor_t)(void *obj);
+typedef void (*slab_dtor_t)(void *obj);
+
+/*
+ * If align is nonzero (it must then be a power of two) every object is
+ * aligned to it. Objects that are often used should pass SLAB_CACHE_LINE
+ * so they do not straddle cache lines.
+ */
+#define SLAB_CACHE_LINE         64
+
+slab_allocator_t *slab_allocator_create(const char *name, size_t size, size_t align,
+                                        slab_ctor_t ctor, slab_dtor_t dtor);
 int slab_allocators_reclaim(int target);
 
 void *slab_obj_alloc(slab_allocator_t *allocator);
 void slab_obj_free(slab_allocator_t *allocator, void *obj);
+
+size_t slab_info(const void *arg, char *buf, size_t size);
@@ -37,7 +37,8 @@ static inline void tlb_flush_range(uintptr_t vaddr, uint32_t count)
         }
 }
 
-/* Invalidates the entire TLB. */
+/* Invalidates the entire TLB, except for the global kernel
+ * mappings (see pt_init), which never change. */
 static inline void tlb_flush_all()
 {
         uintptr_t pdir;
@@ -38,6 +38,11 @@ typedef struct kthread {
         int             kt_state;       /* this thread's state */
         list_link_t     kt_qlink;       /* link on ktqueue */
         list_link_t     kt_plink;       /* link on proc thread list */
+        int             kt_timeslice;   /* clock ticks left before preemption */
+        uint32_t        kt_runticks;    /* clock ticks spent running */
+        int             kt_static_prio; /* priority the thread was given */
+        int             kt_prio;        /* priority it is currently queued at */
+        int             kt_exclusive;   /* 1 if sleeping as an exclusive waiter */
 #ifdef __MTP__
         int             kt_detached;    /* if the thread has been detached */
         ktqueue_t       kt_joinq;       /* thread waiting to join with this thread */
@@ -13,6 +13,8 @@
 
 #pragma once
 
+#include "types.h"
+
 #include "util/list.h"
 
 struct kthread;
@@ -21,6 +23,17 @@ typedef struct ktqueue {
         int             tq_size;
 } ktqueue_t;
 
+/*
+ * Scheduling priorities, lower values are more urgent. The run queue
+ * keeps one list per level and always runs a thread from the most
+ * urgent non-empty one.
+ */
+#define SCHED_NPRIO     8
+#define PRIO_HIGHEST    0
+#define PRIO_DAEMON     2       /* memory daemons: pageoutd, pfilld, shadowd */
+#define PRIO_DEFAULT    4       /* init, the kshell and user processes */
+#define PRIO_LOWEST     (SCHED_NPRIO - 1)
+
 /**
  * Switches execution between kernel threads.
  */
@@ -65,6 +78,39 @@ void sched_sleep_on(ktqueue_t *q);
  */
 int sched_cancellable_sleep_on(ktqueue_t *q);
 
+/**
+ * Like sched_sleep_on, but the thread sleeps as an exclusive waiter:
+ * sched_wakeup_n only wakes as many of those as it is asked to, where
+ * every other waiter is woken. Use this when each woken thread will
+ * consume what it was waiting for, so waking more would only send the
+ * rest straight back to sleep.
+ *
+ * @param q the queue to sleep on
+ */
+void sched_sleep_on_exclusive(ktqueue_t *q);
+
+/**
+ * Like sched_sleep_on, but the thread is also woken once the given
+ * number of clock ticks has passed.
+ *
+ * @param q the queue to sleep on
+ * @param ticks how long to sleep for at most
+ * @return 0 if the sleep timed out, and the number of ticks left if
+ * the thread was woken early
+ */
+uint32_t sched_sleep_on_timeout(ktqueue_t *q, uint32_t ticks);
+
+/**
+ * Like sched_cancellable_sleep_on, but the thread is also woken once
+ * the given number of clock ticks has passed.
+ *
+ * @param q the queue to sleep on
+ * @param ticks how long to sleep for at most, updated to the number of
+ * ticks left when the thread wakes
+ * @return -EINTR if the thread was cancelled and 0 otherwise
+ */
+int sched_cancellable_sleep_on_timeout(ktqueue_t *q, uint32_t *ticks);
+
 /**
  * Wakes a single thread from sleep if there are any waiting on the
  * queue.
@@ -74,6 +120,16 @@ int sched_cancellable_sleep_on(ktqueue_t *q);
  */
 struct kthread *sched_wakeup_on(ktqueue_t *q);
 
+/**
+ * Wakes every thread sleeping on the queue which is not an exclusive
+ * waiter, and up to n of the exclusive waiters, oldest first.
+ *
+ * @param q the queue to wake up threads from
+ * @param n the most exclusive waiters to wake
+ * @return the number of threads woken
+ */
+int sched_wakeup_n(ktqueue_t *q, int n);
+
 /**
  * Wake up all threads running on the queue.
  *
@@ -87,3 +143,26 @@ void sched_broadcast_on(ktqueue_t *q);
  * @param the thread to cancel sleep from
  */
 void sched_cancel(struct kthread *kthr);
+
+/**
+ * Charges a clock tick to the current thread, marking it to be preempted
+ * once it has used up its time slice. Called from the timer interrupt.
+ */
+void sched_tick(void);
+
+/**
+ * Switches to another runnable thread if the current one has used up its
+ * time slice. Must only be called where the current thread holds nothing
+ * another thread could need, such as on return from an interrupt to user
+ * mode.
+ */
+void sched_preempt(void);
+
+/**
+ * Sets the static priority of a thread and resets its dynamic priority
+ * to match. The thread must not be on the run queue.
+ *
+ * @param thr the thread
+ * @param prio the priority, between PRIO_HIGHEST and PRIO_LOWEST
+ */
+void sched_set_priority(struct kthread *thr, int prio);
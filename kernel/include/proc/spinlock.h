@@ -0,0 +1,59 @@
+/******************************************************************************/
+/* Important Spring 2015 CSCI 402 usage information:                          */
+/*                                                                            */
+/* This fils is part of CSCI 402 kernel programming assignments at USC.       */
+/* Please understand that you are NOT permitted to distribute or publically   */
+/*         display a copy of this file (or ANY PART of it) for any reason.    */
+/* If anyone (including your prospective employer) asks you to post the code, */
+/*         you must inform them that you do NOT have permissions to do so.    */
+/* You are also NOT permitted to remove or alter this comment block.          */
+/* If this comment block is removed or altered in a submitted file, 20 points */
+/*         will be deducted.                                                  */
+/******************************************************************************/
+
+#pragma once
+
+#include "types.h"
+
+/*
+ * A spinlock protects data which interrupt handlers, and other processors,
+ * may get at while we hold it. Taking one raises the IPL to IPL_HIGH on
+ * this processor, just as single processor code does by hand, and then
+ * spins until no other processor holds it; releasing it puts the IPL back.
+ * Spinlocks are not re-entrant and must not be held across anything that
+ * may block.
+ */
+typedef struct spinlock {
+        volatile uint32_t sl_locked;    /* 1 while held */
+        int               sl_cpu;       /* cpu_id of the holder */
+        uint8_t           sl_ipl;       /* IPL to restore on release */
+} spinlock_t;
+
+#define SPINLOCK_INITIALIZER    { 0, -1, 0 }
+
+/**
+ * Initializes the fields of the specified spinlock_t.
+ *
+ * @param lock the spinlock to initialize
+ */
+void spinlock_init(spinlock_t *lock);
+
+/**
+ * Raises the IPL to IPL_HIGH and takes the spinlock, spinning while
+ * another processor holds it.
+ *
+ * @param lock the spinlock to take
+ */
+void spinlock_lock(spinlock_t *lock);
+
+/**
+ * Releases the spinlock and restores the IPL it was taken at.
+ *
+ * @param lock a spinlock held by this processor
+ */
+void spinlock_unlock(spinlock_t *lock);
+
+/**
+ * @return nonzero if this processor holds the spinlock
+ */
+int spinlock_held(spinlock_t *lock);
@@ -0,0 +1,26 @@
+/******************************************************************************/
+/* Important Spring 2015 CSCI 402 usage information:                          */
+/*                                                                            */
+/* This fils is part of CSCI 402 kernel programming assignments at USC.       */
+/* Please understand that you are NOT permitted to distribute or publically   */
+/*         display a copy of this file (or ANY PART of it) for any reason.    */
+/* If anyone (including your prospective employer) asks you to post the code, */
+/*         you must inform them that you do NOT have permissions to do so.    */
+/* You are also NOT permitted to remove or alter this comment block.          */
+/* If this comment block is removed or altered in a submitted file, 20 points */
+/*         will be deducted.                                                  */
+/******************************************************************************/
+
+#pragma once
+
+#include "types.h"
+#include "config.h"
+
+/* The clock ticks every TICK_MSECS milliseconds. */
+#define TICKS_PER_SEC           (1000 / TICK_MSECS)
+
+/* Clock ticks since the timer was started. */
+extern volatile uint32_t jiffies;
+
+#define msecs_to_jiffies(ms)    ((ms) / TICK_MSECS + (0 != (ms) % TICK_MSECS))
+#define jiffies_to_msecs(j)     ((j) * TICK_MSECS)
@@ -0,0 +1,67 @@
+/******************************************************************************/
+/* Important Spring 2015 CSCI 402 usage information:                          */
+/*                                                                            */
+/* This fils is part of CSCI 402 kernel programming assignments at USC.       */
+/* Please understand that you are NOT permitted to distribute or publically   */
+/*         display a copy of this file (or ANY PART of it) for any reason.    */
+/* If anyone (including your prospective employer) asks you to post the code, */
+/*         you must inform them that you do NOT have permissions to do so.    */
+/* You are also NOT permitted to remove or alter this comment block.          */
+/* If this comment block is removed or altered in a submitted file, 20 points */
+/*         will be deducted.                                                  */
+/******************************************************************************/
+
+#pragma once
+
+#include "types.h"
+
+#include "util/list.h"
+
+typedef void (*timer_func_t)(void *data);
+
+/*
+ * A one-shot callback run from the clock interrupt once jiffies reaches
+ * t_expires. The structure belongs to the caller, who must make sure it
+ * is no longer pending before freeing it.
+ */
+typedef struct timer {
+        timer_func_t    t_func;         /* called when the timer expires */
+        void           *t_data;         /* argument passed to t_func */
+        uint32_t        t_expires;      /* jiffies at which it expires */
+        list_link_t     t_link;         /* link on a timer wheel slot */
+} timer_t;
+
+#define timer_pending(timer)    list_link_is_linked(&(timer)->t_link)
+
+/**
+ * Initializes a timer which is not yet pending.
+ *
+ * @param timer the timer
+ * @param func the function to call when the timer expires
+ * @param data the argument to pass to func
+ */
+void timer_init(timer_t *timer, timer_func_t func, void *data);
+
+/**
+ * Arms a timer. The callback runs from interrupt context with the IPL
+ * raised to high, so it must not block. A time in the past fires on the
+ * next clock tick.
+ *
+ * @param timer the timer, which must not be pending
+ * @param expires the value of jiffies at which the timer expires
+ */
+void timer_add(timer_t *timer, uint32_t expires);
+
+/**
+ * Disarms a timer if it is pending.
+ *
+ * @param timer the timer
+ * @return 1 if the timer was pending and 0 if it had already expired
+ * or was never armed
+ */
+int timer_del(timer_t *timer);
+
+/**
+ * Runs the timers which have expired. Called on every clock tick.
+ */
+void timer_run(void);
@@ -42,11 +42,16 @@ typedef struct vmarea {
         struct vmmap  *vma_vmmap;    /* address space that this area belongs to */
         struct mmobj  *vma_obj;      /* the vm object to read pages from */
         list_link_t    vma_plink;    /* link on process vmmap maps list */
-        list_link_t    vma_olink;    /* link on the list of all vm_areas
-                                      * having the same vm_object at the
-                                      * bottom of their chain */
+        struct vmarea *vma_rleft;    /* children in the reverse map of all */
+        struct vmarea *vma_rright;   /* vm_areas having the same vm_object */
+        uint32_t       vma_rmax;     /* at the bottom of their chain, and the
+                                      * highest vma_off + npages below here */
 } vmarea_t;
 
+/* Called on each vm_area mapping a page of an object, with the virtual
+ * frame number the page appears at in that area. */
+typedef void (*vmarea_rmap_func_t)(vmarea_t *vma, uint32_t vfn, void *arg);
+
 void vmmap_init(void);
 
 size_t vmmap_mapping_info(const void *map, char *buf, size_t size);
@@ -55,6 +60,11 @@ vmmap_t *vmmap_create(void);
 void vmmap_destroy(vmmap_t *map);
 
 vmarea_t *vmmap_lookup(vmmap_t *map, uint32_t vfn);
+
+void vmarea_rmap_insert(vmarea_t *vma);
+void vmarea_rmap_remove(vmarea_t *vma);
+void vmarea_rmap_iterate(struct mmobj *o, uint32_t pagenum,
+                         vmarea_rmap_func_t func, void *arg);
 int vmmap_map(vmmap_t *map, struct vnode *file, uint32_t lopage, uint32_t npages, int prot, int flags, off_t off, int dir, vmarea_t **new);
 int vmmap_remove(vmmap_t *map, uint32_t lopage, uint32_t npages);
 int vmmap_is_range_empty(vmmap_t *map, uint32_t startvfn, uint32_t npages);
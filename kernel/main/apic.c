@@ -16,6 +16,7 @@
 #include "main/io.h"
 #include "main/acpi.h"
 #include "main/cpuid.h"
+#include "main/smp.h"
 
 #include "mm/page.h"
 #include "mm/pagetable.h"
@@ -143,13 +144,13 @@ struct ioapic_table {
 };
 
 static struct apic_table *apic = NULL;
-static struct lapic_table *lapic = NULL;
+static struct lapic_table *lapic = NULL; /* the boot processor's */
 static struct ioapic_table *ioapic = NULL;
 
 
 static uint32_t __lapic_getid(void)
 {
-	return (LAPICID >> 24) & 0x0f;
+	return (LAPICID >> 24) & 0xff;
 }
 
 static uint32_t __lapic_getver(void)
@@ -283,13 +284,17 @@ void apic_enable_periodic_timer(uint32_t freq) {
 	outb(0x61, (uint8_t)tmp | 1);
 	/* reset APIC timer (set counter to -1) */
 	*(uint32_t*)(apic->at_addr + LOCAL_APIC_TMRINITCNT) = 0xffffffff;
-	/* wait until the PIT reaches zero */
+	/* wait until the PIT reaches zero, 0x2e9b of its 1193182Hz
+	 * ticks or 10ms from the start */
 	while(!(inb(0x61) & 0x20));
 	/* Stop the APIC timer */
 	*(uint32_t*)(apic->at_addr + LOCAL_APIC_LVT_TMR) = LOCAL_APIC_DISABLE;
-	/* some math */
-	cpubusfreq = ((0xffffffff - *(uint32_t*)(apic->at_addr + LOCAL_APIC_TMRINITCNT)) + 1) * 16 * 100;
-	tmp = (cpubusfreq / freq / 16) * 10000;
+	/* it counted down once every 16 bus cycles (the divide
+	 * configuration is 0x03) for those 10ms */
+	tmp = 0xffffffff - *(uint32_t*)(apic->at_addr + LOCAL_APIC_TMRCURRCNT);
+	cpubusfreq = tmp * 16 * 100;
+	/* freq is in Hz */
+	tmp = tmp * 100 / freq;
 	dbgq(DBG_CORE, "CPU Bus Freq: %u\n", cpubusfreq);
 	dbgq(DBG_CORE, "APIC Timer initial count %u\n", tmp);
 	/* Set up the APIC timer for periodic mode */
@@ -338,10 +343,11 @@ void apic_init()
         KASSERT(PAGE_ALIGNED(apic->at_addr));
         apic->at_addr = pt_phys_perm_map(apic->at_addr, 1);
 
-        /* Get the tables for the local APIC and IO APICS,
-         * Weenix currently only supports one of each, in order
-         * to enforce this a KASSERT will fail this if more than one
-         * of each type is found */
+        /* Get the tables for the local APICs and IO APICS. There is
+         * a local APIC for each processor, but Weenix only runs on the
+         * one it booted on; the others are recorded (see smp_add_cpu)
+         * and left waiting for a startup IPI. It also only supports one IO APIC, in order to enforce
+         * this a KASSERT will fail if more than one is found */
         uint8_t off = sizeof(*apic);
         while (off < apic->at_header.ah_size) {
                 uint8_t type = *(ptr + off);
@@ -349,13 +355,18 @@ void apic_init()
                 if (TYPE_LAPIC == type) {
                         KASSERT(apic_exists() && "Local APIC does not exist");
                         KASSERT(sizeof(struct lapic_table) == size);
-                        KASSERT(NULL == lapic && "Weenix only supports a single local APIC");
-                        lapic = (struct lapic_table *)(ptr + off);
+                        struct lapic_table *entry = (struct lapic_table *)(ptr + off);
                         dbgq(DBG_CORE, "LAPIC:\n");
-                        dbgq(DBG_CORE, "   id:         0x%.2x\n", (uint32_t)lapic->at_apicid);
-                        dbgq(DBG_CORE, "   processor:  0x%.3x\n", (uint32_t)lapic->at_procid);
-                        dbgq(DBG_CORE, "   enabled:    %i\n", lapic->at_flags & 0x1);
-                        KASSERT(lapic->at_flags & 0x1 && "The local APIC is disabled");
+                        dbgq(DBG_CORE, "   id:         0x%.2x\n", (uint32_t)entry->at_apicid);
+                        dbgq(DBG_CORE, "   processor:  0x%.3x\n", (uint32_t)entry->at_procid);
+                        dbgq(DBG_CORE, "   enabled:    %i\n", entry->at_flags & 0x1);
+                        if (entry->at_flags & 0x1) {
+                                if (entry->at_apicid == __lapic_getid()) {
+                                        KASSERT(NULL == lapic);
+                                        lapic = entry;
+                                }
+                                smp_add_cpu(entry->at_apicid, entry == lapic);
+                        }
                 } else if (TYPE_IOAPIC == type) {
                         KASSERT(apic_exists() && "IO APIC does not exist");
                         KASSERT(sizeof(struct ioapic_table) == size);
@@ -372,7 +383,9 @@ void apic_init()
                 }
                 off += size;
         }
-        KASSERT(NULL != lapic && "Could not find a local APIC device");
+        KASSERT(NULL != lapic && "Could not find the boot processor's local APIC");
+        dbgq(DBG_CORE, "%i processor(s), running on the one with local APIC 0x%.2x\n",
+             smp_ncpus(), (uint32_t)lapic->at_apicid);
         KASSERT(NULL != ioapic && "Could not find an IO APIC");
 
 	dbgq(DBG_CORE, "--- Enabling APIC ---\n");
@@ -409,6 +422,11 @@ void apic_eoi()
         LAPICEOI = 0x0;
 }
 
+uint32_t apic_current_id()
+{
+        return __lapic_getid();
+}
+
 void apic_setredir(uint32_t irq, uint8_t intr)
 {
         dbg(DBG_CORE, "redirecting irq %u to interrupt %hhu\n", irq, intr);
@@ -21,6 +21,8 @@
 #include "main/interrupt.h"
 #include "main/gdt.h"
 
+#include "proc/sched.h"
+
 #define MAX_INTERRUPTS          256
 
 #define INTR_SPURIOUS      0xef
@@ -397,6 +399,13 @@ static __attribute__((used)) void __intr_handler(regs_t regs)
         }
 
         _intr_regs = NULL;
+
+#ifdef __UPREEMPT__
+        /* Returning to user mode the kernel is not in the middle of
+         * anything for this thread, so it is safe to preempt it. */
+        if (3 == (regs.r_cs & 3))
+                sched_preempt();
+#endif
 }
 
 static void __intr_divide_by_zero_handler(regs_t *regs)
@@ -248,6 +248,7 @@ idleproc_run(int arg1, void *arg2)
         do_mknod("/dev/null", S_IFCHR, MKDEVID(1, 0)); /*null*/
         do_mknod("/dev/tty0", S_IFCHR, MKDEVID(2, 0)); /*tty0*/
         do_mknod("/dev/zero", S_IFCHR, MKDEVID(1, 1)); /*zero*/
+        do_mknod("/dev/slabinfo", S_IFCHR, MEM_SLABINFO_DEVID);
        /* NOT_YET_IMPLEMENTED("VFS: idleproc_run");*/
 
 #endif
@@ -0,0 +1,79 @@
+/******************************************************************************/
+/* Important Spring 2015 CSCI 402 usage information:                          */
+/*                                                                            */
+/* This fils is part of CSCI 402 kernel programming assignments at USC.       */
+/* Please understand that you are NOT permitted to distribute or publically   */
+/*         display a copy of this file (or ANY PART of it) for any reason.    */
+/* If anyone (including your prospective employer) asks you to post the code, */
+/*         you must inform them that you do NOT have permissions to do so.    */
+/* You are also NOT permitted to remove or alter this comment block.          */
+/* If this comment block is removed or altered in a submitted file, 20 points */
+/*         will be deducted.                                                  */
+/******************************************************************************/
+
+#include "globals.h"
+#include "kernel.h"
+#include "config.h"
+
+#include "main/apic.h"
+#include "main/smp.h"
+
+#include "util/debug.h"
+
+/* The boot processor is known before the ACPI tables are read, so that
+ * smp_self works from the start. */
+static cpu_t smp_cpus[SMP_MAX_CPUS] = { { 0, 0, 1 } };
+static int smp_ncpus_found = 1;
+
+void
+smp_add_cpu(uint32_t apicid, int boot)
+{
+        cpu_t *cpu;
+
+        if (boot) {
+                smp_cpus[0].cpu_apicid = apicid;
+                return;
+        }
+        if (SMP_MAX_CPUS == smp_ncpus_found) {
+                dbg(DBG_CORE, "ignoring processor with local APIC 0x%.2x, "
+                    "only %d are supported\n", apicid, SMP_MAX_CPUS);
+                return;
+        }
+        cpu = &smp_cpus[smp_ncpus_found];
+        cpu->cpu_id = smp_ncpus_found++;
+        cpu->cpu_apicid = apicid;
+        cpu->cpu_online = 0;
+}
+
+int
+smp_ncpus(void)
+{
+        return smp_ncpus_found;
+}
+
+cpu_t *
+smp_cpu(int id)
+{
+        KASSERT(0 <= id && id < smp_ncpus_found);
+        return &smp_cpus[id];
+}
+
+cpu_t *
+smp_self(void)
+{
+        uint32_t apicid;
+        int i;
+
+        /* nothing else runs kernel code yet, and this also works before
+         * the local APIC has been mapped */
+        if (1 == smp_ncpus_found)
+                return &smp_cpus[0];
+
+        apicid = apic_current_id();
+        for (i = 0; i < smp_ncpus_found; ++i) {
+                if (apicid == smp_cpus[i].cpu_apicid)
+                        return &smp_cpus[i];
+        }
+        panic("running on a processor with unknown local APIC 0x%.2x\n", apicid);
+        return NULL;
+}
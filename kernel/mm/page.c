@@ -13,16 +13,21 @@
 
 #include "types.h"
 #include "kernel.h"
+#include "config.h"
 
 #include "mm/mm.h"
 #include "mm/page.h"
 #include "mm/slab.h"
+#include "mm/shrinker.h"
 
 #include "util/gdb.h"
 #include "util/bits.h"
 #include "util/list.h"
 #include "util/debug.h"
 #include "util/string.h"
+#include "util/printf.h"
+
+#include "mm/pframe.h"
 
 #include "vm/shadowd.h"
 
@@ -31,12 +36,86 @@
 GDB_DEFINE_HOOK(page_alloc, void *addr, int npages)
 GDB_DEFINE_HOOK(page_free, void *addr, int npages)
 
-static list_t pagegroup_list;
+static list_t pagegroup_list;          /* sorted by address */
 static uintptr_t page_freecount;
 
+/*
+ * Free blocks of every pagegroup, by order. The buddy bitmaps stay in
+ * their groups; page_orders has bit n set iff page_freelist[n] is not
+ * empty, so the smallest block able to satisfy a request is found
+ * without looking at any list.
+ */
+static list_t page_freelist[PAGE_NSIZES];
+static uint32_t page_nfree[PAGE_NSIZES];
+static uint32_t page_orders;
+
+/*
+ * Maps each 4MB slice of the address space to the lowest addressed
+ * pagegroup overlapping it, so the group owning a page is found without
+ * walking pagegroup_list. Groups sharing a slice are found by following
+ * pg_link, which is at most a step or two.
+ */
+#define PAGEGROUP_TABLE_SHIFT 22
+static struct pagegroup *pagegroup_table[1 << (32 - PAGEGROUP_TABLE_SHIFT)];
+
+/*
+ * Recently freed single pages, kept out of the buddy lists so that the
+ * page_alloc/page_free churn of page frames, page tables and kernel
+ * stacks skips splitting and joining. Used as a stack, so the page handed
+ * out is the one most likely to still be in the CPU cache. The pages
+ * count as free, and move to and from the buddy lists PAGE_HOT_BATCH at
+ * a time.
+ */
+static void *page_hot[PAGE_HOT_CACHE];
+static int page_nhot;
+
+static struct {
+        uint32_t ph_hits;       /* page_alloc served from the cache */
+        uint32_t ph_misses;     /* page_alloc went to the buddy lists */
+        uint32_t ph_drained;    /* pages given back to the buddy lists */
+} page_hot_stats;
+
+/*
+ * Compaction state, see _page_compact. While a block is being emptied,
+ * its free pages and the pages moved out of it are kept on page_isolated
+ * rather than the buddy lists, so nothing is moved back into it.
+ */
+struct isolatedblock {
+        list_link_t ib_link;
+        uint32_t    ib_order;
+};
+
+static int page_compacting;
+static uintptr_t page_compact_lo;
+static uintptr_t page_compact_hi;
+static list_t page_isolated;
+
+static struct {
+        uint32_t pc_runs;       /* times an allocation tried compacting */
+        uint32_t pc_blocks;     /* blocks emptied */
+        uint32_t pc_moved;      /* page frames moved */
+} page_compact_stats;
+
+/*
+ * Free pages which have already been filled with zeroes by the idle loop,
+ * so that allocations which need zeroed memory (anonymous pages, page
+ * tables) do not pay for the memset. They are taken out of the buddy
+ * lists but still count as free, and are given back to the buddy
+ * allocator when it runs out of memory.
+ */
+static void *page_zeroed[PAGE_ZERO_POOL];
+static int page_nzeroed;
+
+static struct {
+        uint32_t pz_hits;       /* page_alloc_zeroed served from the pool */
+        uint32_t pz_misses;     /* page_alloc_zeroed had to zero a page */
+        uint32_t pz_idle;       /* pages zeroed by the idle loop */
+        uint32_t pz_drained;    /* pages given back to the buddy allocator */
+} page_zero_stats;
+
 struct pagegroup {
-        list_t       pg_freelist[PAGE_NSIZES];
         void        *pg_map[PAGE_NSIZES];
+        void        *pg_freemap;        /* bit set per page in the buddy lists */
         uintptr_t    pg_baseaddr;
         uintptr_t    pg_endaddr;
         list_link_t  pg_link;
@@ -46,6 +125,73 @@ struct freepage {
         list_link_t fp_link;
 };
 
+static inline void
+_page_freelist_insert(uint32_t order, uintptr_t addr)
+{
+        list_insert_head(&page_freelist[order], &((struct freepage *)addr)->fp_link);
+        page_nfree[order]++;
+        page_orders |= BIT(order);
+}
+
+static inline void
+_page_freelist_remove(uint32_t order, uintptr_t addr)
+{
+        list_remove(&((struct freepage *)addr)->fp_link);
+        if (0 == --page_nfree[order])
+                page_orders &= ~BIT(order);
+}
+
+/* Sets (free) or clears the pg_freemap bits of the 2^order pages at addr. */
+static void
+_pagegroup_mark(struct pagegroup *group, uintptr_t addr, uint32_t order, int free)
+{
+        uint32_t *map = (uint32_t *)group->pg_freemap;
+        uintptr_t bit = (addr - group->pg_baseaddr) >> PAGE_SHIFT;
+        uint32_t n = 1 << order;
+
+        while (n > 0) {
+                uint32_t shift = bit & 0x1f;
+                uint32_t len = MIN(n, 32 - shift);
+                uint32_t mask = (32 == len) ? 0xffffffff : ((1U << len) - 1) << shift;
+                if (free)
+                        map[bit >> 5] |= mask;
+                else
+                        map[bit >> 5] &= ~mask;
+                bit += len;
+                n -= len;
+        }
+}
+
+/* __builtin_popcount would need libgcc */
+static inline uint32_t
+_page_popcount(uint32_t x)
+{
+        x = x - ((x >> 1) & 0x55555555);
+        x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+        x = (x + (x >> 4)) & 0x0f0f0f0f;
+        return (x * 0x01010101) >> 24;
+}
+
+/* Counts the pages of the 2^order block at addr which are in the buddy lists. */
+static uint32_t
+_pagegroup_count_free(struct pagegroup *group, uintptr_t addr, uint32_t order)
+{
+        uint32_t *map = (uint32_t *)group->pg_freemap;
+        uintptr_t bit = (addr - group->pg_baseaddr) >> PAGE_SHIFT;
+        uint32_t n = 1 << order;
+        uint32_t nfree = 0;
+
+        while (n > 0) {
+                uint32_t shift = bit & 0x1f;
+                uint32_t len = MIN(n, 32 - shift);
+                uint32_t mask = (32 == len) ? 0xffffffff : ((1U << len) - 1) << shift;
+                nfree += _page_popcount(map[bit >> 5] & mask);
+                bit += len;
+                n -= len;
+        }
+        return nfree;
+}
+
 static struct pagegroup *
 _pagegroup_create(uintptr_t start, uintptr_t end)
 {
@@ -61,6 +207,12 @@ _pagegroup_create(uintptr_t start, uintptr_t end)
         group->pg_baseaddr = start;
         group->pg_map[0] = NULL;
 
+        /* word aligned, see _pagegroup_mark */
+        uintptr_t mapsize = (((npages - 1) & ~((uintptr_t)0x1f)) + 32) >> 3;
+        end = (end - mapsize) & ~((uintptr_t)0x3);
+        group->pg_freemap = (void *)end;
+        memset(group->pg_freemap, 0, mapsize);
+
         /* allocate some of the space for the buddy bit maps,
          * we allocate enough bits to track all pages even
          * though some pages will be unavailable since they
@@ -84,7 +236,6 @@ _pagegroup_create(uintptr_t start, uintptr_t end)
         /* put pages which do not fit nicely into the largest
          * order and add them to smaller buckets */
         for (order = 0; order < PAGE_NSIZES - 1; ++order) {
-                list_init(&group->pg_freelist[order]);
                 if (npages & (1 << order)) {
                         end -= (1 << order) << PAGE_SHIFT;
                         /*
@@ -97,16 +248,16 @@ _pagegroup_create(uintptr_t start, uintptr_t end)
                          * Then call page_alloc() in an infinite loop in bootstrap().  This will cause a failed assertion
                          * when page_freecount reaches 4.
                          */
-                        /* list_insert_head(&group->pg_freelist[order], &((struct freepage *)end)->fp_link); */
+                        /* _page_freelist_insert(order, end); */
                 }
         }
 
         /* put the remaining pages into the largest bucket */
         KASSERT(0 == (end - start) % (1 << order));
-        list_init(&group->pg_freelist[order]);
         uintptr_t current = start;
         while (current < end) {
-                list_insert_head(&group->pg_freelist[order], &((struct freepage *)current)->fp_link);
+                _page_freelist_insert(order, current);
+                _pagegroup_mark(group, current, order, 1);
                 current += (1 << order) << PAGE_SHIFT;
         }
 
@@ -116,18 +267,56 @@ _pagegroup_create(uintptr_t start, uintptr_t end)
 static struct pagegroup *
 _pagegroup_from_address(uintptr_t addr)
 {
-        struct pagegroup *group;
-        list_iterate_begin(&pagegroup_list, group, struct pagegroup, pg_link) {
-                if (addr >= group->pg_baseaddr && addr < group->pg_endaddr)
-                        return group;
+        struct pagegroup *group = pagegroup_table[addr >> PAGEGROUP_TABLE_SHIFT];
+
+        while (NULL != group && addr >= group->pg_endaddr) {
+                if (group->pg_link.l_next == &pagegroup_list)
+                        return NULL;
+                group = list_item(group->pg_link.l_next, struct pagegroup, pg_link);
+        }
+        if (NULL == group || addr < group->pg_baseaddr)
+                return NULL;
+        return group;
+}
+
+/* Adds a group to pagegroup_list, in address order, and to the slices
+ * of pagegroup_table it overlaps. */
+static void
+_pagegroup_insert(struct pagegroup *group)
+{
+        struct pagegroup *succ;
+        uint32_t slice;
+
+        list_iterate_begin(&pagegroup_list, succ, struct pagegroup, pg_link) {
+                if (succ->pg_baseaddr > group->pg_baseaddr) {
+                        list_insert_before(&succ->pg_link, &group->pg_link);
+                        goto inserted;
+                }
         } list_iterate_end();
-        return NULL;
+        list_insert_tail(&pagegroup_list, &group->pg_link);
+
+inserted:
+        for (slice = group->pg_baseaddr >> PAGEGROUP_TABLE_SHIFT;
+             slice <= (group->pg_endaddr - 1) >> PAGEGROUP_TABLE_SHIFT; ++slice) {
+                if (NULL == pagegroup_table[slice]
+                    || pagegroup_table[slice]->pg_baseaddr > group->pg_baseaddr)
+                        pagegroup_table[slice] = group;
+        }
 }
 
 void
 page_init()
 {
+        int order;
+
         list_init(&pagegroup_list);
+        list_init(&page_isolated);
+        page_compacting = 0;
+        for (order = 0; order < PAGE_NSIZES; ++order) {
+                list_init(&page_freelist[order]);
+                page_nfree[order] = 0;
+        }
+        page_orders = 0;
         page_freecount = 0;
 }
 
@@ -142,7 +331,7 @@ page_add_range(uintptr_t start, uintptr_t end)
 
         struct pagegroup *group = _pagegroup_create(start, end);
         if (group->pg_baseaddr < group->pg_endaddr) {
-                list_insert_tail(&pagegroup_list, &group->pg_link);
+                _pagegroup_insert(group);
                 page_freecount += ADDR_TO_PN(group->pg_endaddr - group->pg_baseaddr);
         }
 }
@@ -173,15 +362,17 @@ _pagegroup_calculate_index(struct pagegroup *group, uint32_t order, uintptr_t ad
 }
 
 static void
-__page_split(struct pagegroup *group, uint32_t order)
+__page_split(uint32_t order)
 {
         KASSERT(0 < order);
         KASSERT(PAGE_NSIZES > order);
-        KASSERT(!list_empty(&group->pg_freelist[order]));
+        KASSERT(!list_empty(&page_freelist[order]));
         KASSERT(PAGE_SIZE >= sizeof(uintptr_t));
 
-        uintptr_t target = (uintptr_t)list_head(&group->pg_freelist[order], struct freepage, fp_link);
-        list_remove_head(&group->pg_freelist[order]);
+        uintptr_t target = (uintptr_t)list_head(&page_freelist[order], struct freepage, fp_link);
+        struct pagegroup *group = _pagegroup_from_address(target);
+        KASSERT(NULL != group);
+        _page_freelist_remove(order, target);
 
         /* splitting the page requires marking it as allocated */
         if (likely(order < PAGE_NSIZES - 1)) {
@@ -192,11 +383,143 @@ __page_split(struct pagegroup *group, uint32_t order)
         KASSERT(!bit_check(group->pg_map[order], _pagegroup_calculate_index(group, order, target)));
 
         uintptr_t buddy = (target + ((1 << (order - 1)) << PAGE_SHIFT));
-        list_insert_head(&group->pg_freelist[order - 1], &((struct freepage *)target)->fp_link);
-        list_insert_head(&group->pg_freelist[order - 1], &((struct freepage *)buddy)->fp_link);
+        _page_freelist_insert(order - 1, target);
+        _page_freelist_insert(order - 1, buddy);
         dbg(DBG_PAGEALLOC, "split 0x%.8x (%u) into 0x%.8x and 0x%.8x\n", target, order, target, buddy);
 }
 
+static void _page_free_order(void *addr, int order);
+
+/* Returns all pre-zeroed pages to the buddy lists.
+ * @return the number of pages given back */
+static int
+_page_zeroed_drain(void)
+{
+        int n = page_nzeroed;
+
+        while (page_nzeroed > 0) {
+                void *addr = page_zeroed[--page_nzeroed];
+                page_freecount--; /* _page_free_order counts it again */
+                _page_free_order(addr, 0);
+        }
+        page_zero_stats.pz_drained += n;
+        return n;
+}
+
+/* Returns the coldest npages pages of the hot page cache to the buddy
+ * lists. */
+static void
+_page_hot_drain(int npages)
+{
+        int i;
+
+        KASSERT(npages <= page_nhot);
+        for (i = 0; i < npages; ++i) {
+                page_freecount--; /* _page_free_order counts it again */
+                _page_free_order(page_hot[i], 0);
+        }
+        for (i = npages; i < page_nhot; ++i)
+                page_hot[i - npages] = page_hot[i];
+        page_nhot -= npages;
+        page_hot_stats.ph_drained += npages;
+}
+
+/* Takes the free block of 2^order pages at addr out of the buddy lists
+ * and puts it on page_isolated. */
+static void
+_page_isolate(struct pagegroup *group, uintptr_t addr, uint32_t order)
+{
+        struct isolatedblock *block = (struct isolatedblock *)addr;
+
+        _page_freelist_remove(order, addr);
+        _pagegroup_mark(group, addr, order, 0);
+        if (PAGE_NSIZES - 1 > order)
+                bit_flip(group->pg_map[order + 1], _pagegroup_calculate_index(group, order + 1, addr));
+        page_freecount -= (1 << order);
+
+        block->ib_order = order;
+        list_insert_head(&page_isolated, &block->ib_link);
+}
+
+/*
+ * Tries to empty the block of 2^order pages at addr, which is not
+ * entirely free, by isolating its free blocks and moving the page frames
+ * in the rest of it elsewhere.
+ * @return nonzero if the block is now free
+ */
+static int
+_page_compact_block(struct pagegroup *group, uintptr_t addr, uint32_t order)
+{
+        uintptr_t end = addr + ((1 << order) << PAGE_SHIFT);
+        uint32_t nfree = _pagegroup_count_free(group, addr, order);
+        int moved;
+
+        if (nfree + pframe_evacuate(addr, end, 0) < (uint32_t)(1 << order))
+                return 0;
+
+        /* The free pages of the block are the starts of free blocks
+         * in order, each the largest aligned run of free pages there */
+        uintptr_t page = addr;
+        while (page < end) {
+                if (0 == _pagegroup_count_free(group, page, 0)) {
+                        page += PAGE_SIZE;
+                        continue;
+                }
+                uint32_t o = order - 1;
+                while (0 != (((page - group->pg_baseaddr) >> PAGE_SHIFT) & ((1 << o) - 1))
+                       || (uint32_t)(1 << o) != _pagegroup_count_free(group, page, o))
+                        --o;
+                _page_isolate(group, page, o);
+                page += (1 << o) << PAGE_SHIFT;
+        }
+
+        page_compacting = 1;
+        page_compact_lo = addr;
+        page_compact_hi = end;
+        moved = pframe_evacuate(addr, end, 1);
+        page_compacting = 0;
+
+        while (!list_empty(&page_isolated)) {
+                struct isolatedblock *block = list_head(&page_isolated, struct isolatedblock, ib_link);
+                list_remove(&block->ib_link);
+                _page_free_order(block, block->ib_order);
+        }
+
+        if (moved > 0)
+                page_compact_stats.pc_moved += moved;
+        return (uint32_t)(1 << order) == _pagegroup_count_free(group, addr, order);
+}
+
+/*
+ * Looks for nearly free blocks of 2^order pages which only hold movable
+ * page frames besides their free pages, and empties the first one found.
+ * At most PAGE_COMPACT_TRIES blocks are looked at closely.
+ * @return nonzero if a block of the order was freed
+ */
+static int
+_page_compact(uint32_t order)
+{
+        struct pagegroup *group;
+        uint32_t size = (1 << order) << PAGE_SHIFT;
+        int tries = PAGE_COMPACT_TRIES;
+
+        page_compact_stats.pc_runs++;
+        list_iterate_begin(&pagegroup_list, group, struct pagegroup, pg_link) {
+                uintptr_t addr;
+                for (addr = group->pg_baseaddr; addr + size <= group->pg_endaddr && tries > 0; addr += size) {
+                        uint32_t nfree = _pagegroup_count_free(group, addr, order);
+                        if (nfree < (uint32_t)(1 << (order - 1)) || nfree == (uint32_t)(1 << order))
+                                continue;
+                        tries--;
+                        if (_page_compact_block(group, addr, order)) {
+                                page_compact_stats.pc_blocks++;
+                                return 1;
+                        }
+                }
+        } list_iterate_end();
+        return 0;
+}
+
 /**
  * Finds a block of pages strictly bigger than a block of the given order and
  * splits it into blocks of the given order. Used, for example, when the user
@@ -204,9 +527,9 @@ __page_split(struct pagegroup *group, uint32_t order)
  * 16k block.
  *
  * @param order the order of the block to split into.
- * @return the group where the split took place on success, NULL otherwise
+ * @return 0 on success, -1 if there is no larger free block
  */
-static struct pagegroup *
+static int
 _page_split(int order)
 {
 #ifdef __SHADOWD__
@@ -218,21 +541,40 @@ _page_split(int order)
 
         do {
                 /* Find the first free block of greater size than requested. */
-                for (norder = order + 1; norder < PAGE_NSIZES; norder++) {
-                        struct pagegroup *group;
-                        list_iterate_begin(&pagegroup_list, group, struct pagegroup, pg_link) {
-                                if (!list_empty(&group->pg_freelist[norder])) {
-                                        while (norder > order) {
-                                                __page_split(group, norder);
-                                                --norder;
-                                        }
-                                        KASSERT(!list_empty(&group->pg_freelist[order]));
-                                        return group;
-                                }
-                        } list_iterate_end();
+                uint32_t larger = page_orders & ~(BIT(order + 1) - 1);
+                if (0 != larger) {
+                        norder = __builtin_ffs(larger) - 1;
+                        while (norder > order) {
+                                __page_split(norder);
+                                --norder;
+                        }
+                        KASSERT(!list_empty(&page_freelist[order]));
+                        return 0;
                 }
 
                 dbg(DBG_PAGEALLOC, "WARNING, cannot allocate order=%u\n", order);
+                if (page_compacting)
+                        return -1; /* moving a page frame, see _page_compact */
+                /* The cached and pre-zeroed pages are the cheapest memory to
+                   get back, and may let the block be joined back together.
+                   Pages freed by the reclaim below land in the cache, so
+                   this also runs after each retry */
+                if (0 < page_nhot || 0 < page_nzeroed) {
+                        _page_hot_drain(page_nhot);
+                        _page_zeroed_drain();
+                        ++num_retrys;
+                        continue;
+                }
+                /* Enough memory may be free, just not in one piece */
+                if (0 < order && _page_compact(order)) {
+                        ++num_retrys;
+                        continue;
+                }
+                /* Ask the caches to give some memory back */
+                if (0 < shrink_caches(MAX(BIT(order), PAGE_SHRINK_BATCH), 0)) {
+                        ++num_retrys;
+                        continue;
+                }
                 /* We have run out of kernel memory. Lets try and collapse some
                    shadow trees, and then retry */
 #ifdef __SHADOWD__
@@ -240,12 +582,10 @@ _page_split(int order)
                 shadowd_wakeup();
                 shadowd_alloc_sleep();
 #endif
-                int num_freed = slab_allocators_reclaim(0);
-                dbg(DBG_MM, "reclaimed %d pages from slab allocator.\n", num_freed);
         } while (num_retrys-- > 0);
 
         /* We are out of memory, and not even the shadow deamon could free some */
-        return NULL;
+        return -1;
 }
 
 /**
@@ -261,20 +601,15 @@ _page_alloc_order(uint32_t order)
         uintptr_t addr;
         struct pagegroup *group;
 
-        list_iterate_begin(&pagegroup_list, group, struct pagegroup, pg_link) {
-                if (!list_empty(&group->pg_freelist[order]))
-                        goto found;
-        } list_iterate_end();
-
-        if (NULL != (group = _page_split(order))) {
-                KASSERT(!list_empty(&group->pg_freelist[order]));
-                goto found;
-        }
-        return NULL;
+        if (!(page_orders & BIT(order)) && 0 != _page_split(order))
+                return NULL;
+        KASSERT(!list_empty(&page_freelist[order]));
 
-found:
-        addr = (uintptr_t)list_head(&group->pg_freelist[order], struct freepage, fp_link);
-        list_remove_head(&group->pg_freelist[order]);
+        addr = (uintptr_t)list_head(&page_freelist[order], struct freepage, fp_link);
+        group = _pagegroup_from_address(addr);
+        KASSERT(NULL != group);
+        _page_freelist_remove(order, addr);
+        _pagegroup_mark(group, addr, order, 0);
         if (PAGE_NSIZES - 1 > order)
                 bit_flip(group->pg_map[order + 1], _pagegroup_calculate_index(group, order + 1, addr));
 
@@ -305,11 +640,11 @@ __page_join(struct pagegroup *group, int order, uintptr_t addr)
 
                 dbg(DBG_PAGEALLOC, "joining 0x%.8x and 0x%.8x (%u) into 0x%.8x\n", addr, buddy, order, MIN(offset, buddy));
 
-                list_remove(&((struct freepage *)addr)->fp_link);
-                list_remove(&((struct freepage *)buddy)->fp_link);
+                _page_freelist_remove(order, addr);
+                _page_freelist_remove(order, buddy);
                 addr = MIN(addr, buddy);
                 ++order;
-                list_insert_head(&group->pg_freelist[order], &((struct freepage *)addr)->fp_link);
+                _page_freelist_insert(order, addr);
 
                 if (PAGE_NSIZES - 1 > order)
                         bit_flip(group->pg_map[order + 1], _pagegroup_calculate_index(group, order + 1, (uintptr_t)addr));
@@ -338,7 +673,8 @@ _page_free_order(void *addr, int order)
         if (NULL == group)
                 return;
 
-        list_insert_head(&group->pg_freelist[order], &((struct freepage *)addr)->fp_link);
+        _page_freelist_insert(order, (uintptr_t)addr);
+        _pagegroup_mark(group, (uintptr_t)addr, order, 1);
         page_freecount += (1 << order);
 
         if (PAGE_NSIZES - 1 > order) {
@@ -358,7 +694,25 @@ _page_free_order(void *addr, int order)
 void *
 page_alloc(void)
 {
-        void *addr =  _page_alloc_order(0);
+        void *addr;
+
+        if (page_nhot > 0) {
+                addr = page_hot[--page_nhot];
+                page_freecount--;
+                page_hot_stats.ph_hits++;
+#ifdef MM_POISON
+                memset(addr, MM_POISON_ALLOC, PAGE_SIZE);
+#endif /* MM_POISON */
+        } else {
+                page_hot_stats.ph_misses++;
+                addr = _page_alloc_order(0);
+                /* refill with whatever is free without having to reclaim */
+                while (NULL != addr && page_nhot < PAGE_HOT_BATCH && 0 != page_orders) {
+                        page_hot[page_nhot++] = _page_alloc_order(0);
+                        page_freecount++;
+                }
+        }
+
         GDB_CALL_HOOK(page_alloc, addr, 1);
         return addr;
 }
@@ -371,7 +725,23 @@ void
 page_free(void *addr)
 {
         GDB_CALL_HOOK(page_free, addr, 1);
-        _page_free_order(addr, 0);
+        KASSERT(PAGE_ALIGNED(addr));
+
+        if (page_compacting && (uintptr_t)addr >= page_compact_lo
+            && (uintptr_t)addr < page_compact_hi) {
+                struct isolatedblock *block = (struct isolatedblock *)addr;
+                block->ib_order = 0;
+                list_insert_head(&page_isolated, &block->ib_link);
+                return;
+        }
+
+        if (page_nhot == PAGE_HOT_CACHE)
+                _page_hot_drain(PAGE_HOT_BATCH);
+#ifdef MM_POISON
+        memset(addr, MM_POISON_FREE, PAGE_SIZE);
+#endif /* MM_POISON */
+        page_hot[page_nhot++] = addr;
+        page_freecount++;
 }
 
 /*
@@ -414,6 +784,56 @@ page_free_n(void *start, uint32_t npages)
         _page_free_order(start, order);
 }
 
+/*
+ * Allocate one page of zeroes, from the pool of pages zeroed by the idle
+ * loop when possible.
+ * @return the address of the page
+ */
+void *
+page_alloc_zeroed(void)
+{
+        void *addr;
+
+        if (page_nzeroed > 0) {
+                addr = page_zeroed[--page_nzeroed];
+                page_freecount--;
+                page_zero_stats.pz_hits++;
+                GDB_CALL_HOOK(page_alloc, addr, 1);
+                return addr;
+        }
+
+        page_zero_stats.pz_misses++;
+        if (NULL != (addr = page_alloc()))
+                memset(addr, 0, PAGE_SIZE);
+        return addr;
+}
+
+/*
+ * Zero one free page into the pool. This is called with nothing else to
+ * run, so pages are zeroed one at a time to notice new work quickly.
+ * @return nonzero if a page was zeroed
+ */
+int
+page_zero_idle(void)
+{
+        void *addr;
+
+        if (page_nzeroed >= PAGE_ZERO_POOL)
+                return 0;
+        /* only zero pages which are free without splitting, so that the
+           pool never breaks up larger blocks */
+        if (!(page_orders & BIT(0)))
+                return 0;
+
+        addr = _page_alloc_order(0);
+        KASSERT(NULL != addr);
+        memset(addr, 0, PAGE_SIZE);
+        page_zeroed[page_nzeroed++] = addr;
+        page_freecount++; /* still free, just not in the buddy lists */
+        page_zero_stats.pz_idle++;
+        return 1;
+}
+
 /*
  * @return the number of free pages in the kmem system
  */
@@ -422,3 +842,40 @@ page_free_count()
 {
         return page_freecount;
 }
+
+size_t
+page_info(const void *arg, char *buf, size_t osize)
+{
+        size_t size = osize;
+        uint32_t lookups = page_zero_stats.pz_hits + page_zero_stats.pz_misses;
+        uint32_t hot_lookups = page_hot_stats.ph_hits + page_hot_stats.ph_misses;
+
+        int order;
+
+        iprintf(&buf, &size, "free:         %u\n", page_freecount);
+        iprintf(&buf, &size, "free blocks by order:\n");
+        for (order = 0; order < PAGE_NSIZES; ++order) {
+                iprintf(&buf, &size, "  %4uKB:     %u\n",
+                        (PAGE_SIZE >> 10) << order, page_nfree[order]);
+        }
+        iprintf(&buf, &size, "largest free: %d pages\n",
+                0 == page_orders ? 0 : 1 << (31 - __builtin_clz(page_orders)));
+        iprintf(&buf, &size, "compaction:   %u runs, %u blocks freed, %u frames moved\n",
+                page_compact_stats.pc_runs, page_compact_stats.pc_blocks,
+                page_compact_stats.pc_moved);
+        iprintf(&buf, &size, "hot cache:    %d (max %d)\n", page_nhot, PAGE_HOT_CACHE);
+        iprintf(&buf, &size, "  hits:       %u\n", page_hot_stats.ph_hits);
+        iprintf(&buf, &size, "  misses:     %u\n", page_hot_stats.ph_misses);
+        iprintf(&buf, &size, "  hit rate:   %u%%\n",
+                0 == hot_lookups ? 0 : page_hot_stats.ph_hits * 100 / hot_lookups);
+        iprintf(&buf, &size, "  drained:    %u\n", page_hot_stats.ph_drained);
+        iprintf(&buf, &size, "zeroed:       %d (max %d)\n", page_nzeroed, PAGE_ZERO_POOL);
+        iprintf(&buf, &size, "  hits:       %u\n", page_zero_stats.pz_hits);
+        iprintf(&buf, &size, "  misses:     %u\n", page_zero_stats.pz_misses);
+        iprintf(&buf, &size, "  hit rate:   %u%%\n",
+                0 == lookups ? 0 : page_zero_stats.pz_hits * 100 / lookups);
+        iprintf(&buf, &size, "  idle:       %u\n", page_zero_stats.pz_idle);
+        iprintf(&buf, &size, "  drained:    %u\n", page_zero_stats.pz_drained);
+
+        return size;
+}
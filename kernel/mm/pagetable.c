@@ -19,6 +19,7 @@
 #include "globals.h"
 
 #include "main/interrupt.h"
+#include "main/cpuid.h"
 
 #include "mm/mm.h"
 #include "mm/page.h"
@@ -36,6 +37,7 @@
 #include "boot/config.h"
 
 #define PT_ENTRY_COUNT    (PAGE_SIZE / sizeof (uint32_t))
+#define CR4_PGE           0x080 /* honor PT_GLOBAL */
 #define PT_VADDR_SIZE     (PAGE_SIZE * PT_ENTRY_COUNT)
 
 struct pagedir {
@@ -127,11 +129,10 @@ pt_map(pagedir_t *pd, uintptr_t vaddr, uintptr_t paddr, uint32_t pdflags, uint32
 
         pte_t *pt;
         if (!(PT_PRESENT & pd->pd_physical[index])) {
-                if (NULL == (pt = page_alloc())) {
+                if (NULL == (pt = page_alloc_zeroed())) {
                         return -ENOMEM;
                 } else {
                         KASSERT((pdflags & ~PAGE_MASK) == pdflags);
-                        memset(pt, 0, PAGE_SIZE);
                         pd->pd_physical[index] = pt_virt_to_phys((uintptr_t)pt) | pdflags;
                         pd->pd_virtual[index] = pt;
                 }
@@ -165,6 +166,26 @@ pt_unmap(pagedir_t *pd, uintptr_t vaddr)
         }
 }
 
+int
+pt_test_and_clear_accessed(pagedir_t *pd, uintptr_t vaddr, uintptr_t paddr)
+{
+        KASSERT(PAGE_ALIGNED(vaddr) && PAGE_ALIGNED(paddr));
+        KASSERT(USER_MEM_LOW <= vaddr && USER_MEM_HIGH > vaddr);
+
+        int index = vaddr_to_pdindex(vaddr);
+
+        if (PT_PRESENT & pd->pd_physical[index]) {
+                pte_t *pte = (pte_t *)pd->pd_virtual[index] + vaddr_to_ptindex(vaddr);
+
+                if ((PT_PRESENT & *pte) && (PT_ACCESSED & *pte)
+                    && paddr == (*pte & PAGE_MASK)) {
+                        *pte &= ~PT_ACCESSED;
+                        return 1;
+                }
+        }
+        return 0;
+}
+
 void
 pt_unmap_range(pagedir_t *pd, uintptr_t vlow, uintptr_t vhigh)
 {
@@ -306,17 +327,36 @@ pt_init(void)
         pte_t *pagetable = final_page + PT_ENTRY_COUNT;
         _pt_fill_page(pagedir, pagetable, PD_PRESENT | PD_WRITE, PT_PRESENT | PT_WRITE, 0, 0);
 
+        /* The kernel's mappings are the same in every address space, so
+         * when the processor supports it they are made global, which
+         * keeps their TLB entries across the cr3 reloads of context
+         * switches. Only the identity map above, which is dropped again
+         * by pt_template_init, must not be global. (4mb pages would give
+         * even more TLB reach, but the kernel is loaded at
+         * KERNEL_PHYS_BASE, 1mb into a 4mb page, so its physical map
+         * cannot be built from them.) */
+        uint32_t eax, edx;
+        cpuid(CPUID_GETFEATURES, &eax, &edx);
+        pte_t kflags = PT_PRESENT | PT_WRITE;
+        if (edx & CPUID_FEAT_EDX_PGE)
+                kflags |= PT_GLOBAL;
+
         /* map in 4mb (one page table) where the kernel is
          * this will make our new page table identical to the temporary
          * page table the boot loader created. */
         pagetable += PT_ENTRY_COUNT;
-        _pt_fill_page(pagedir, pagetable, PD_PRESENT | PD_WRITE, PT_PRESENT | PT_WRITE,
+        _pt_fill_page(pagedir, pagetable, PD_PRESENT | PD_WRITE, kflags,
                       (uintptr_t)&kernel_start, KERNEL_PHYS_BASE);
 
         current_pagedir = pagedir;
         /* swap the temporary page table with our identical, but more
          * permanant page table */
         pt_set(pagedir);
+        if (PT_GLOBAL & kflags) {
+                uint32_t cr4;
+                __asm__ volatile("movl %%cr4, %0" : "=r"(cr4));
+                __asm__ volatile("movl %0, %%cr4" :: "r"(cr4 | CR4_PGE) : "memory");
+        }
 
         uintptr_t physmax = phys_detect_highmem();
         dbgq(DBG_MM, "Highest usable physical memory: 0x%08x\n", physmax);
@@ -328,7 +368,7 @@ pt_init(void)
                 pagetable += PT_ENTRY_COUNT;
                 vaddr += PT_VADDR_SIZE;
                 paddr += PT_VADDR_SIZE;
-                _pt_fill_page(pagedir, pagetable, PD_PRESENT | PD_WRITE, PT_PRESENT | PT_WRITE, vaddr, paddr);
+                _pt_fill_page(pagedir, pagetable, PD_PRESENT | PD_WRITE, kflags, vaddr, paddr);
         } while (paddr < physmax);
 
         page_add_range((uintptr_t) pagetable + PT_ENTRY_COUNT, physmax + ((uintptr_t)&kernel_start) - KERNEL_PHYS_BASE);
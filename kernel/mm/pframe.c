@@ -18,11 +18,14 @@
 #include "proc/proc.h"
 
 #include "util/debug.h"
+#include "util/printf.h"
+#include "util/time.h"
 #include "util/string.h"
 
 #include "mm/mmobj.h"
 #include "mm/page.h"
 #include "mm/slab.h"
+#include "mm/shrinker.h"
 #include "mm/kmalloc.h"
 #include "mm/pframe.h"
 #include "mm/tlb.h"
@@ -63,16 +66,16 @@
  *
  *
  * When a page is allocated or pinned:
- *     - pf_link links the page into allocated_list or pinned_list,
- *       respectively
- *     - pf_hlink links the page into the appropriate hash chain of the
- *       resident page hashtable
+ *     - pf_link links the page into allocated_list (or, with PF2Q, the
+ *       probationary list) or pinned_list, respectively
+ *     - the page is entered in its mmobj's resident page tree
+ *       (see pframe_objinfo) under its page number
  *     - pf_olink links the page into the appropriate mmobj's list of
- *       resident pages
+ *       resident pages, which is kept in page number order
  *
  * When a page is free:
  *     - pf_link links the page into free_list
- *     - pf_hlink does not link the page into any list
+ *     - the page is not in any resident page tree
  *     - pf_olink does not link the page into any list
  */
 
@@ -89,25 +92,147 @@ static list_t pinned_list;
 
 /*     The ALLOCATED list: */
 /*       Pages on this list contain useful/actual/real data. This list is
- *       maintained in least-recently-requested (via pframe_get or
- *       pframe_get_resident) (and thus, *roughly/approximately* LRU) order.
+ *       the CLOCK of a second-chance replacement policy: pageoutd's hand
+ *       is always at the head. A page is referenced if it was requested
+ *       (via pframe_get or pframe_get_resident), which sets PF_REFERENCED,
+ *       or if the MMU set the accessed bit in any user mapping of it since
+ *       the hand last passed. Referenced pages have their bits cleared and
+ *       are moved to the tail; unreferenced pages are reclaimed.
  */
 static int nallocated;
 static list_t alloc_list;
 
+#ifdef __PF2Q__
+/*     The PROBATIONARY list: */
+/*       With the 2Q policy, alloc_list only holds pages which have proven
+ *       themselves (the "protected" pages, marked PF_PROTECTED) and newly
+ *       filled pages start out here instead, in FIFO order, whatever
+ *       happens to them in the meantime. pageoutd reclaims from this list
+ *       first whenever it holds more than its share of the unpinned pages,
+ *       so a one-time scan through a large file only ever displaces other
+ *       probationary pages. nallocated counts the pages on both lists.
+ *
+ *       The identities of pages reclaimed from here are remembered as
+ *       "ghosts"; a page which is brought back in while its ghost is still
+ *       around has been used twice within a reasonable time and goes
+ *       straight onto alloc_list. Ghosts are not removed when their mmobj
+ *       goes away, so a recycled mmobj may see a spurious promotion; that
+ *       only costs a little cache efficiency.
+ */
+static int nprobation;
+static list_t probation_list;
+
+struct pframe_ghost {
+        struct mmobj       *pg_obj;      /* NULL if the slot is unused */
+        uint32_t            pg_pagenum;
+        list_link_t         pg_hlink;    /* link on ghost hash chain */
+};
+
+static struct pframe_ghost pframe_ghosts[PF_2Q_NGHOSTS]; /* FIFO ring */
+static int pframe_ghost_next;                             /* oldest slot */
+static list_t pframe_ghost_hash[PF_2Q_GHOST_BUCKETS];
+#define hash_ghost(obj, pagenum) \
+        (&pframe_ghost_hash[((((uint32_t)(obj)) >> 4) + (pagenum)) % PF_2Q_GHOST_BUCKETS])
+#endif /* __PF2Q__ */
+
 static slab_allocator_t *pframe_allocator;
 
-/* Used to quickly look up pframes. ALL pages "owned by" some
- * mmobj should be in this hash
- * (object, pagenum) --> list of pframes */
-#define hash_page(obj, pagenum)  ((((uint32_t)(obj)) + (pagenum)) \
-                                  % PF_HASH_SIZE)
-static list_t pframe_hash[PF_HASH_SIZE];
+/* Replacement statistics, see pframe_info() */
+static struct {
+        uint32_t        ps_hits;        /* pframe_get found the page resident */
+        uint32_t        ps_misses;      /* pframe_get had to fill the page */
+        uint32_t        ps_scanned;     /* pages examined by pageoutd */
+        uint32_t        ps_referenced;  /* ...and given a second chance */
+        uint32_t        ps_evicted;     /* ...and reclaimed */
+        uint32_t        ps_ra_reads;    /* pframe_prefetch calls starting fills */
+        uint32_t        ps_ra_pages;    /* ...pages they started filling */
+        uint32_t        ps_ra_hits;     /* ...which were then asked for */
+        uint32_t        ps_ra_wasted;   /* ...which were freed unused */
+        int             ps_ra_window;   /* latest readahead window */
+        uint32_t        ps_fills;       /* fill requests issued by pfilld */
+        uint32_t        ps_fill_errors; /* ...pages they failed to fill */
+        uint32_t        ps_writes;      /* writeback requests issued */
+        uint32_t        ps_written;     /* ...and pages they wrote back */
+        uint32_t        ps_wb_start;    /* jiffies when this second began */
+        uint32_t        ps_wb_pages;    /* ...pages written back since */
+        uint32_t        ps_wb_rate;     /* pages written in the last second */
+        uint32_t        ps_wakeups;     /* pageoutd woken at the low mark */
+        uint32_t        ps_stalls;      /* allocations which waited at min */
+        uint32_t        ps_stall_wakes; /* ...and times one was woken for a page */
+#ifdef __PF2Q__
+        uint32_t        ps_probation_evicted; /* ...from the probationary list */
+        uint32_t        ps_ghost_hits;  /* misses promoted by a ghost */
+#endif
+} pframe_stats;
 
-/* Related to the Pageout daemon: */
+/*
+ * Counts pages written back towards the writeback rate, which is taken
+ * over whole seconds; a longer gap since the last writeback lowers it.
+ */
+static void
+pframe_wb_account(uint32_t npages)
+{
+        uint32_t elapsed = jiffies - pframe_stats.ps_wb_start;
+
+        if (elapsed >= TICKS_PER_SEC) {
+                pframe_stats.ps_wb_rate = pframe_stats.ps_wb_pages * TICKS_PER_SEC / elapsed;
+                pframe_stats.ps_wb_start = jiffies;
+                pframe_stats.ps_wb_pages = 0;
+        }
+        pframe_stats.ps_wb_pages += npages;
+}
+
+/* Used to quickly look up pframes. ALL pages "owned by" some mmobj are
+ * in that mmobj's resident page tree, a radix tree indexed by page number
+ * with PF_TREE_FANOUT slots per node. Leaf nodes (height 1) hold pframes,
+ * interior nodes hold child nodes. A tree of height h covers page numbers
+ * up to pftree_maxindex(h); it only grows as tall as the largest resident
+ * page number requires, so lookups in small objects touch a single node.
+ * Nodes are freed as soon as they become empty.
+ * (object, pagenum) --> pframe */
+#define PF_TREE_FANOUT           (1 << PF_TREE_SHIFT)
+#define PF_TREE_MASK             (PF_TREE_FANOUT - 1)
+#define PF_TREE_MAXHEIGHT        ((32 + PF_TREE_SHIFT - 1) / PF_TREE_SHIFT)
+#define pftree_maxindex(h)       (((h) * PF_TREE_SHIFT >= 32) ? 0xffffffff : \
+                                  ((uint32_t)1 << ((h) * PF_TREE_SHIFT)) - 1)
+#define pftree_slot(pagenum, h)  (((pagenum) >> (((h) - 1) * PF_TREE_SHIFT)) \
+                                  & PF_TREE_MASK)
+
+struct pframe_tnode {
+        int                 pt_count;                 /* non-NULL slots */
+        void               *pt_slots[PF_TREE_FANOUT]; /* nodes or pframes */
+};
+
+static slab_allocator_t *pftree_allocator;
+
+/* The root of each tree is kept here rather than in the mmobj, whose
+ * layout is shared with the prebuilt drivers and file system. There is
+ * an entry for exactly those mmobjs which have resident pages: it is
+ * made when the first page is entered and freed with the last one, so an
+ * object whose pages have all been reclaimed starts readahead afresh.
+ * mmobj --> pframe_objinfo */
+struct pframe_objinfo {
+        struct mmobj       *po_obj;
+        list_link_t         po_hlink;    /* link on hash chain */
+        struct pframe_tnode *po_pftree;  /* root of the resident page tree */
+        int                 po_pfheight; /* levels in po_pftree, 0 if empty */
+        uint32_t            po_ra_next;  /* page a sequential reader misses next */
+        int                 po_ra_window; /* pages read per miss, see pframe_get */
+};
+
+static slab_allocator_t *pframe_objinfo_allocator;
+static list_t pframe_objinfo_hash[PF_OBJ_BUCKETS];
+#define hash_objinfo(obj) \
+        (&pframe_objinfo_hash[(((uint32_t)(obj)) >> 4) % PF_OBJ_BUCKETS])
 
+/* Related to the Pageout daemon: */
+/*   Free page watermarks. Once the number of free pages drops to
+ *   nfreepages_low, pframe_get wakes pageoutd, which then reclaims in the
+ *   background until nfreepages_high pages are free. Only when it drops to
+ *   nfreepages_min do allocating threads have to wait for pageoutd. */
 static uint32_t nfreepages_min = 0;
-static uint32_t nfreepages_target = 0;
+static uint32_t nfreepages_low = 0;
+static uint32_t nfreepages_high = 0;
 
 /*   pageoutd sleeps on this queue */
 static proc_t *pageoutd = NULL;
@@ -117,41 +242,94 @@ static ktqueue_t pageoutd_waitq;
 /* threads waiting for pageoutd to run sleep on this queue */
 static ktqueue_t alloc_waitq;
 
+/*   Pages being filled in the background, in the order pframe_prefetch
+ *   queued them; pfilld sleeps on pfilld_waitq until there are some. */
+static pframe_t *pfilld_queue[PF_FILL_QUEUE];
+static int pfilld_head;
+static int pfilld_count;
+static proc_t *pfilld = NULL;
+static kthread_t *pfilld_thr = NULL;
+static ktqueue_t pfilld_waitq;
+
+/* Fill daemon functions */
+static int pfilld_take(pframe_t *pf);
+static void pfilld_finish(pframe_t *pf, int filled);
+
 /* Pageout daemon functions */
 static void *pageoutd_run(int arg1, void *arg2);
 static void pageoutd_exit(void);
 #define pageoutd_wakeup()        (sched_broadcast_on(&pageoutd_waitq))
 #define pageoutd_needed()        \
-	((page_free_count() <= nfreepages_min) && (!list_empty(&alloc_list)))
-#define pageoutd_target_met()    (page_free_count() >= nfreepages_target)
+	((page_free_count() <= nfreepages_low) && (0 != nallocated))
+#define pageoutd_must_wait()     \
+	((page_free_count() <= nfreepages_min) && (0 != nallocated))
+#define pageoutd_target_met()    (page_free_count() >= nfreepages_high)
+
+
+/*
+ * Slab constructors. A pframe is freed unpinned with nobody waiting on
+ * it, and a tree node only once all of its slots are empty, so both go
+ * back to their allocators in these states.
+ */
+static void
+pframe_ctor(void *obj)
+{
+        pframe_t *pf = obj;
+        sched_queue_init(&pf->pf_waitq);
+        pf->pf_pincount = 0;
+}
 
+static void
+pftree_ctor(void *obj)
+{
+        memset(obj, 0, sizeof(struct pframe_tnode));
+}
 
 /*
  * Initialize the pinned and allocated counts and lists. Then, make a pframe
- * slab allocator. You should also list_init all the lists that make
- * up the pframe_hash. Finally, you need to set things up for pageoutd to
- * run by setting nfreepages_min and nfreepages_target.
+ * slab allocator and a slab allocator for the nodes of the per-mmobj
+ * resident page trees. Finally, you need to set things up for pageoutd to
+ * run by setting the free page watermarks.
  */
 void
 pframe_init(void)
 {
+        int i;
+
         /* initialize page lists: */
         npinned = 0;
         list_init(&pinned_list);
         nallocated = 0;
         list_init(&alloc_list);
+#ifdef __PF2Q__
+        nprobation = 0;
+        list_init(&probation_list);
+
+        for (i = 0; i < PF_2Q_GHOST_BUCKETS; ++i)
+                list_init(&pframe_ghost_hash[i]);
+#endif
 
-        pframe_allocator = slab_allocator_create("pframe", sizeof(pframe_t));
+        pframe_allocator = slab_allocator_create("pframe", sizeof(pframe_t),
+                                                 SLAB_CACHE_LINE, pframe_ctor, NULL);
         KASSERT(NULL != pframe_allocator);
 
-        /* initialize pframe_hash: */
-        int i;
-        for (i = 0; i < PF_HASH_SIZE; ++i)
-                list_init(&pframe_hash[i]);
+        pftree_allocator = slab_allocator_create("pframe_tnode",
+                                                 sizeof(struct pframe_tnode),
+                                                 0, pftree_ctor, NULL);
+        KASSERT(NULL != pftree_allocator);
+
+        pframe_objinfo_allocator = slab_allocator_create("pframe_objinfo",
+                                                         sizeof(struct pframe_objinfo),
+                                                         0, NULL, NULL);
+        KASSERT(NULL != pframe_objinfo_allocator);
+        for (i = 0; i < PF_OBJ_BUCKETS; ++i)
+                list_init(&pframe_objinfo_hash[i]);
 
         /* initialize pageout parameters: */
-        nfreepages_target = page_free_count() >> 1;
-        nfreepages_min = 0;
+        nfreepages_high = page_free_count() >> PAGEOUTD_FREE_TARGET_SHIFT;
+        nfreepages_min = page_free_count() >> PAGEOUTD_FREE_MIN_SHIFT;
+        nfreepages_low = (nfreepages_min + nfreepages_high) >> 1;
+        KASSERT(nfreepages_min <= nfreepages_low && nfreepages_low <= nfreepages_high);
 
 		/* initialize alloc_waitq */
 		sched_queue_init(&alloc_waitq);
@@ -162,12 +340,18 @@ pframe_shutdown()
 {
         KASSERT(PID_IDLE == curproc->p_pid); /* Should call from idleproc */
 
-        /* Stop pageoutd and wait for it */
+        /* Stop pageoutd and pfilld and wait for them */
         pageoutd_exit();
+        KASSERT(NULL != pfilld_thr);
+        kthread_cancel(pfilld_thr, (void *) 0);
+        pfilld_thr = NULL;
 
-        int pid = pageoutd->p_pid;
-        int child = do_waitpid(-1, 0, NULL);
-        KASSERT(pid == child && "waited on process other than pageoutd");
+        int i;
+        for (i = 0; i < 2; ++i) {
+                int child = do_waitpid(-1, 0, NULL);
+                KASSERT((pageoutd->p_pid == child || pfilld->p_pid == child)
+                        && "waited on process other than pageoutd or pfilld");
+        }
         KASSERT(0 == npinned && "WARNING: FOUND PINNED "
                 "PAGES!!!!!!!!!! SOMETHING IS BROKEN!!\n");
 
@@ -182,6 +366,312 @@ pframe_shutdown()
                 KASSERT(!pframe_is_pinned(pf));
                 pframe_free(pf);
         } list_iterate_end();
+#ifdef __PF2Q__
+        list_iterate_begin(&probation_list, pf, pframe_t, pf_link) {
+                KASSERT(!pframe_is_dirty(pf));
+                KASSERT(!pframe_is_busy(pf));
+                KASSERT(!pframe_is_pinned(pf));
+                pframe_free(pf);
+        } list_iterate_end();
+#endif
+}
+
+/*
+ * Puts an unpinned page at the tail of the list it belongs on and counts
+ * it as allocated.
+ */
+static void
+pframe_list_insert(pframe_t *pf)
+{
+#ifdef __PF2Q__
+        if (!(PF_PROTECTED & pf->pf_flags)) {
+                nprobation++;
+                nallocated++;
+                list_insert_tail(&probation_list, &pf->pf_link);
+                return;
+        }
+#endif
+        nallocated++;
+        list_insert_tail(&alloc_list, &pf->pf_link);
+}
+
+/*
+ * Takes an unpinned page off the list it is on.
+ */
+static void
+pframe_list_remove(pframe_t *pf)
+{
+#ifdef __PF2Q__
+        if (!(PF_PROTECTED & pf->pf_flags))
+                nprobation--;
+#endif
+        nallocated--;
+        list_remove(&pf->pf_link);
+}
+
+#ifdef __PF2Q__
+/*
+ * Remembers that the page identified by o and pagenum was reclaimed from the
+ * probationary list, forgetting the oldest ghost if need be.
+ */
+static void
+pframe_ghost_add(mmobj_t *o, uint32_t pagenum)
+{
+        struct pframe_ghost *g = &pframe_ghosts[pframe_ghost_next];
+
+        if (NULL != g->pg_obj)
+                list_remove(&g->pg_hlink);
+        g->pg_obj = o;
+        g->pg_pagenum = pagenum;
+        list_insert_head(hash_ghost(o, pagenum), &g->pg_hlink);
+        pframe_ghost_next = (pframe_ghost_next + 1) % PF_2Q_NGHOSTS;
+}
+
+/*
+ * If the page identified by o and pagenum has a ghost, forgets it.
+ *
+ * @return 1 if there was a ghost, 0 otherwise
+ */
+static int
+pframe_ghost_take(mmobj_t *o, uint32_t pagenum)
+{
+        struct pframe_ghost *g;
+
+        list_iterate_begin(hash_ghost(o, pagenum), g, struct pframe_ghost, pg_hlink) {
+                if (o == g->pg_obj && pagenum == g->pg_pagenum) {
+                        list_remove(&g->pg_hlink);
+                        g->pg_obj = NULL;
+                        return 1;
+                }
+        } list_iterate_end();
+        return 0;
+}
+#endif /* __PF2Q__ */
+
+/*
+ * Returns the entry holding o's resident page tree, or NULL if o has no
+ * resident pages.
+ */
+static struct pframe_objinfo *
+pframe_objinfo_lookup(mmobj_t *o)
+{
+        struct pframe_objinfo *po;
+
+        list_iterate_begin(hash_objinfo(o), po, struct pframe_objinfo, po_hlink) {
+                if (o == po->po_obj)
+                        return po;
+        } list_iterate_end();
+        return NULL;
+}
+
+/*
+ * Returns the page with number pagenum in o's resident page tree, or NULL.
+ */
+static pframe_t *
+pftree_lookup(mmobj_t *o, uint32_t pagenum)
+{
+        struct pframe_objinfo *po;
+        struct pframe_tnode *node;
+        int height;
+
+        if (NULL == (po = pframe_objinfo_lookup(o)))
+                return NULL;
+        node = po->po_pftree;
+        height = po->po_pfheight;
+        if (NULL == node || pagenum > pftree_maxindex(height))
+                return NULL;
+        while (height > 1) {
+                node = node->pt_slots[pftree_slot(pagenum, height)];
+                if (NULL == node)
+                        return NULL;
+                height--;
+        }
+        return node->pt_slots[pftree_slot(pagenum, 1)];
+}
+
+/*
+ * Returns the resident page with the lowest page number >= pagenum in the
+ * subtree rooted at node, which has the given height, or NULL if there is
+ * none. Only the bits of pagenum below this subtree are looked at.
+ */
+static pframe_t *
+pftree_find_ge(struct pframe_tnode *node, int height, uint32_t pagenum)
+{
+        uint32_t i;
+        void *slot;
+
+        for (i = pftree_slot(pagenum, height); i < PF_TREE_FANOUT; ++i, pagenum = 0) {
+                if (NULL == (slot = node->pt_slots[i]))
+                        continue;
+                if (1 == height)
+                        return slot;
+                if (NULL != (slot = pftree_find_ge(slot, height - 1, pagenum)))
+                        return slot;
+        }
+        return NULL;
+}
+
+/*
+ * Removes the page with number pagenum (if any) from o's resident page tree.
+ * Along the way, frees every node on the path to pagenum which is left with
+ * no children, and then lowers the tree while the root only has a child in
+ * slot 0. The tree's entry goes once the tree is empty. Never fails; also
+ * used to undo a partially completed insert.
+ */
+static void
+pftree_remove(mmobj_t *o, uint32_t pagenum)
+{
+        struct pframe_tnode *path[PF_TREE_MAXHEIGHT];
+        struct pframe_objinfo *po;
+        struct pframe_tnode *node;
+        int height;
+        int depth = 0;
+
+        if (NULL == (po = pframe_objinfo_lookup(o)))
+                return;
+        node = po->po_pftree;
+        height = po->po_pfheight;
+        if (NULL == node || pagenum > pftree_maxindex(height))
+                goto out;
+
+        /* path[d] is the node at height (po->po_pfheight - d) */
+        while (NULL != node) {
+                path[depth++] = node;
+                if (1 == height)
+                        break;
+                node = node->pt_slots[pftree_slot(pagenum, height)];
+                height--;
+        }
+
+        if (NULL != node) {
+                /* reached a leaf, pagenum is present or its slot is empty */
+                if (NULL != node->pt_slots[pftree_slot(pagenum, 1)]) {
+                        node->pt_slots[pftree_slot(pagenum, 1)] = NULL;
+                        node->pt_count--;
+                }
+        }
+
+        /* free empty nodes bottom-up, unlinking each from its parent */
+        while (depth > 0 && 0 == path[depth - 1]->pt_count) {
+                slab_obj_free(pftree_allocator, path[--depth]);
+                if (depth > 0) {
+                        height = po->po_pfheight - depth + 1;
+                        path[depth - 1]->pt_slots[pftree_slot(pagenum, height)] = NULL;
+                        path[depth - 1]->pt_count--;
+                } else {
+                        po->po_pftree = NULL;
+                        po->po_pfheight = 0;
+                        goto out;
+                }
+        }
+
+        /* shrink */
+        node = po->po_pftree;
+        while (po->po_pfheight > 1 && 1 == node->pt_count && NULL != node->pt_slots[0]) {
+                po->po_pftree = node->pt_slots[0];
+                po->po_pfheight--;
+                node->pt_slots[0] = NULL;
+                node->pt_count = 0;
+                slab_obj_free(pftree_allocator, node);
+                node = po->po_pftree;
+        }
+
+out:
+        if (NULL == po->po_pftree) {
+                list_remove(&po->po_hlink);
+                slab_obj_free(pframe_objinfo_allocator, po);
+        }
+}
+
+/*
+ * Enters pf into o's resident page tree under pf->pf_pagenum, growing the
+ * tree as needed. pf->pf_pagenum must not already be resident in o.
+ *
+ * @return 0 on success, -ENOMEM if a tree node could not be allocated, in
+ * which case the tree is left as it was
+ */
+static int
+pftree_insert(mmobj_t *o, pframe_t *pf)
+{
+        uint32_t pagenum = pf->pf_pagenum;
+        struct pframe_objinfo *po;
+        struct pframe_tnode *node, *child;
+        uint32_t i;
+        int height;
+
+        KASSERT(NULL == pftree_lookup(o, pagenum));
+
+        if (NULL == (po = pframe_objinfo_lookup(o))) {
+                if (NULL == (po = slab_obj_alloc(pframe_objinfo_allocator)))
+                        return -ENOMEM;
+                po->po_obj = o;
+                po->po_pftree = NULL;
+                po->po_pfheight = 0;
+                po->po_ra_next = 0;
+                po->po_ra_window = 0;
+                list_insert_head(hash_objinfo(o), &po->po_hlink);
+        }
+
+        /* Grow the tree until it covers pagenum. An empty tree just changes
+         * height; otherwise the old root becomes child 0 of a new root. */
+        while (0 == po->po_pfheight || pagenum > pftree_maxindex(po->po_pfheight)) {
+                if (NULL != po->po_pftree) {
+                        if (NULL == (node = slab_obj_alloc(pftree_allocator)))
+                                return -ENOMEM;
+                        node->pt_slots[0] = po->po_pftree;
+                        node->pt_count = 1;
+                        po->po_pftree = node;
+                }
+                po->po_pfheight++;
+        }
+
+        if (NULL == po->po_pftree) {
+                if (NULL == (po->po_pftree = slab_obj_alloc(pftree_allocator))) {
+                        list_remove(&po->po_hlink);
+                        slab_obj_free(pframe_objinfo_allocator, po);
+                        return -ENOMEM;
+                }
+        }
+
+        /* walk down, creating missing interior nodes */
+        node = po->po_pftree;
+        for (height = po->po_pfheight; height > 1; --height) {
+                i = pftree_slot(pagenum, height);
+                if (NULL == node->pt_slots[i]) {
+                        if (NULL == (child = slab_obj_alloc(pftree_allocator))) {
+                                /* frees the nodes we just created */
+                                pftree_remove(o, pagenum);
+                                return -ENOMEM;
+                        }
+                        node->pt_slots[i] = child;
+                        node->pt_count++;
+                }
+                node = node->pt_slots[i];
+        }
+        node->pt_slots[pftree_slot(pagenum, 1)] = pf;
+        node->pt_count++;
+
+        return 0;
+}
+
+/*
+ * Links pf, which must already be in o's resident page tree, into o's
+ * resident page list just before the next resident page up.
+ */
+static void
+pftree_link(mmobj_t *o, pframe_t *pf)
+{
+        struct pframe_objinfo *po = pframe_objinfo_lookup(o);
+        pframe_t *succ = NULL;
+
+        KASSERT(NULL != po);
+        if (pf->pf_pagenum < pftree_maxindex(po->po_pfheight))
+                succ = pftree_find_ge(po->po_pftree, po->po_pfheight,
+                                      pf->pf_pagenum + 1);
+        if (NULL != succ)
+                list_insert_before(&succ->pf_olink, &pf->pf_olink);
+        else
+                list_insert_tail(&o->mmo_respages, &pf->pf_olink);
 }
 
 /*
@@ -202,25 +692,16 @@ pframe_shutdown()
 pframe_t *
 pframe_get_resident(struct mmobj *o, uint32_t pagenum)
 {
-        list_t *hashchain;
         pframe_t *pf;
 
-        hashchain = &pframe_hash[hash_page(o, pagenum)];
-        list_iterate_begin(hashchain, pf, pframe_t, pf_hlink) {
-                if ((o == pf->pf_obj) && (pagenum == pf->pf_pagenum)) {
-                        /* found a page with the specified identity. It is
-                         * up to the caller to recognize/care if the page
-                         * is busy. */
-                        if (!pframe_is_pinned(pf)) {
-                                /* send to back of alloc_list */
-                                list_remove(&pf->pf_link);
-                                list_insert_tail(&alloc_list, &pf->pf_link);
-                        }
-                        return pf;
-                }
-        } list_iterate_end();
-
-        return NULL;
+        if (NULL != (pf = pftree_lookup(o, pagenum))) {
+                KASSERT(o == pf->pf_obj && pagenum == pf->pf_pagenum);
+                /* found a page with the specified identity. It is
+                 * up to the caller to recognize/care if the page
+                 * is busy. */
+                pframe_set_referenced(pf);
+        }
+        return pf;
 }
 
 /*
@@ -250,20 +731,29 @@ pframe_alloc(mmobj_t *o, uint32_t pagenum)
                 return NULL;
         }
 
-        nallocated++;
-        list_insert_tail(&alloc_list, &pf->pf_link);
-
         pf->pf_obj = o;
         pf->pf_pagenum = pagenum;
-        pf->pf_flags = 0;
-        sched_queue_init(&pf->pf_waitq);
-        pf->pf_pincount = 0;
+        if (0 > pftree_insert(o, pf)) {
+                dbg(DBG_PFRAME, "WARNING: not enough kernel memory\n");
+                page_free(pf->pf_addr);
+                slab_obj_free(pframe_allocator, pf);
+                return NULL;
+        }
 
-        list_insert_head(&pframe_hash[hash_page(o, pagenum)], &pf->pf_hlink);
+        pf->pf_flags = 0;
+#ifdef __PF2Q__
+        if (pframe_ghost_take(o, pagenum)) {
+                pframe_stats.ps_ghost_hits++;
+                pf->pf_flags |= PF_PROTECTED;
+        }
+#endif
+        KASSERT(sched_queue_empty(&pf->pf_waitq));
+        KASSERT(0 == pf->pf_pincount);
+        pframe_list_insert(pf);
 
         o->mmo_ops->ref(o);
         o->mmo_nrespages++;
-        list_insert_head(&o->mmo_respages, &pf->pf_olink);
+        pftree_link(o, pf);
 
         return pf;
 }
@@ -284,8 +774,10 @@ pframe_lookup(struct mmobj *o, uint32_t pagenum, int forwrite, pframe_t **result
  *
  * @param pf page to be migrated
  * @param dest destination vm object
+ * @return 0 on success, -ENOMEM if dest's resident page tree could not be
+ * extended, in which case pf is left where it was
  */
-void
+int
 pframe_migrate(pframe_t *pf, mmobj_t *dest)
 {
         KASSERT(!pframe_is_busy(pf));
@@ -296,16 +788,67 @@ pframe_migrate(pframe_t *pf, mmobj_t *dest)
                 pframe_free(pf);
         } else {
                 mmobj_t *src = pf->pf_obj;
-                pf->pf_obj = dest;
-                list_remove(&pf->pf_hlink);
+                if (0 > pftree_insert(dest, pf)) {
+                        dbg(DBG_PFRAME, "WARNING: not enough kernel memory\n");
+                        return -ENOMEM;
+                }
+                pftree_remove(src, pf->pf_pagenum);
                 list_remove(&pf->pf_olink);
+                pftree_link(dest, pf);
+                pf->pf_obj = dest;
                 src->mmo_nrespages--;
                 src->mmo_ops->put(src);
-                list_insert_head(&pframe_hash[hash_page(dest, pf->pf_pagenum)], &pf->pf_hlink);
-                list_insert_head(&dest->mmo_respages, &pf->pf_olink);
                 dest->mmo_nrespages++;
                 dest->mmo_ops->ref(dest);
         }
+        return 0;
+}
+
+static int
+pframe_evacuate_list(list_t *list, uintptr_t lo, uintptr_t hi, int move)
+{
+        pframe_t *pf;
+        int n = 0;
+
+        list_iterate_begin(list, pf, pframe_t, pf_link) {
+                uintptr_t addr = (uintptr_t) pf->pf_addr;
+                if (addr >= lo && addr < hi && !pframe_is_busy(pf)) {
+                        if (move) {
+                                void *dest = page_alloc();
+                                if (NULL == dest)
+                                        return -ENOMEM;
+                                pframe_remove_from_pts(pf);
+                                memcpy(dest, pf->pf_addr, PAGE_SIZE);
+                                page_free(pf->pf_addr);
+                                pf->pf_addr = dest;
+                        }
+                        n++;
+                }
+        } list_iterate_end();
+        return n;
+}
+
+/*
+ * Moves the idle, unpinned page frames whose memory lies in [lo, hi) to
+ * other pages, so that the page allocator can coalesce the range (see
+ * _page_compact). Frames are removed from user page tables first, and
+ * fault back in at their new address.
+ *
+ * @param move if zero, only count the frames which could be moved
+ * @return the number of frames moved (or movable), or -ENOMEM if there
+ * was no page left to move a frame to
+ */
+int
+pframe_evacuate(uintptr_t lo, uintptr_t hi, int move)
+{
+        int n = pframe_evacuate_list(&alloc_list, lo, hi, move);
+#ifdef __PF2Q__
+        if (n >= 0) {
+                int m = pframe_evacuate_list(&probation_list, lo, hi, move);
+                n = (m < 0) ? m : n + m;
+        }
+#endif
+        return n;
 }
 
 /*
@@ -327,6 +870,61 @@ pframe_fill(pframe_t *pf)
         return ret;
 }
 
+/*
+ * Updates o's readahead state for a miss on page pagenum and returns how
+ * many pages, starting with pagenum, should be read in for it. A miss on
+ * the page right after the ones the previous miss read in means the
+ * object is being read sequentially, so the window grows, starting from
+ * PF_READAHEAD_MIN and doubling up to PF_READAHEAD_MAX. Any other miss
+ * means random access and shuts readahead off until the next sequential
+ * miss. Only objects with a fillpages entry point read ahead.
+ */
+static int
+pframe_readahead_window(mmobj_t *o, uint32_t pagenum)
+{
+        struct pframe_objinfo *po = pframe_objinfo_lookup(o);
+
+        /* the page missed on is already in the tree */
+        KASSERT(NULL != po);
+        if (NULL == o->mmo_ops->fillpages)
+                return 1;
+
+        if (pagenum != po->po_ra_next)
+                po->po_ra_window = 1;
+        else if (po->po_ra_window < PF_READAHEAD_MIN)
+                po->po_ra_window = PF_READAHEAD_MIN;
+        else
+                po->po_ra_window = MIN(po->po_ra_window << 1, PF_READAHEAD_MAX);
+        po->po_ra_next = pagenum + po->po_ra_window;
+
+        return po->po_ra_window;
+}
+
+/*
+ * Fills the newly allocated page pf, which was just missed on, and starts
+ * filling the rest of the readahead window behind it in the background
+ * (see pframe_prefetch()). The readahead is queued first so that pfilld
+ * can issue it while we are blocked on pf.
+ *
+ * @param pf the page to fill
+ */
+static int
+pframe_fill_ahead(pframe_t *pf)
+{
+        mmobj_t *o = pf->pf_obj;
+        int want;
+
+        want = pframe_readahead_window(o, pf->pf_pagenum);
+        if (want > 1) {
+                dbg(DBG_PFRAME, "reading ahead pages %d-%d of obj %p\n",
+                    pf->pf_pagenum + 1, pf->pf_pagenum + want - 1, o);
+                if (0 < pframe_prefetch(o, pf->pf_pagenum + 1, want - 1))
+                        pframe_stats.ps_ra_window = want;
+        }
+
+        return pframe_fill(pf);
+}
+
 /*
  * Find and return the pframe representing the page identified by the object
  * and page number. If the page is already resident in memory, then we return
@@ -350,35 +948,106 @@ pframe_fill(pframe_t *pf)
 int
 pframe_get(struct mmobj *o, uint32_t pagenum, pframe_t **result)
 {
-        /*NOT_YET_IMPLEMENTED("VM: pframe_get");
-        return 0;*/
-		/*result = NULL;*/
-		pframe_t* ppage =NULL;
-        while((ppage = pframe_get_resident(o, pagenum))==NULL){
-       /*if page is not found, allocate or call pageoutd*/
-        	if(pageoutd_needed()){/*if we need pageoutd to run, wake it up*/
-        		pageoutd_wakeup();
-        		sched_sleep_on(&alloc_waitq);
-        		continue;
-        	} else {/*allocate a new page*/
-        		ppage = pframe_alloc(o, pagenum);
-        		if(ppage==NULL) {
-        			return -ENOMEM;
-        		}
-        		int ret = pframe_fill(ppage);
-        		if(ret < 0) {
-        			pframe_free(ppage);
-        			return ret;
-        		}
-        		*result = ppage;
-        		return 0;
-        	}
-        };
-       while(pframe_is_busy(ppage)) { /*found but it's busy*/
-    	   sched_sleep_on(&(ppage->pf_waitq)); /* wait for it to become not busy*/
-       }
-       *result = ppage; /*if not busy*/
-       return 0;
+        pframe_t *pf;
+        int ret;
+
+        while (1) {
+                if (NULL != (pf = pframe_get_resident(o, pagenum))) {
+                        if (pframe_is_busy(pf)) {
+                                if (curthr == pfilld_thr && pfilld_take(pf)) {
+                                        /* pfilld needs a page still on its
+                                         * own queue (say a block the file
+                                         * it is filling maps through), and
+                                         * nobody else would fill it */
+                                        pframe_stats.ps_fills++;
+                                        pfilld_finish(pf, 0 <= o->mmo_ops->fillpage(o, pf));
+                                        continue;
+                                }
+                                /* wait for it to become not busy, then look
+                                 * again, since it may have been freed */
+                                sched_sleep_on(&pf->pf_waitq);
+                                continue;
+                        }
+                        pframe_stats.ps_hits++;
+                        if (PF_READAHEAD & pf->pf_flags) {
+                                pf->pf_flags &= ~PF_READAHEAD;
+                                pframe_stats.ps_ra_hits++;
+                        }
+                        *result = pf;
+                        return 0;
+                }
+
+                /* not resident; wake pageoutd if we are getting low, but
+                 * only wait for it when nearly out */
+                if (pageoutd_needed()) {
+                        pframe_stats.ps_wakeups++;
+                        pageoutd_wakeup();
+                }
+                if (pageoutd_must_wait()) {
+                        pframe_stats.ps_stalls++;
+                        sched_sleep_on_exclusive(&alloc_waitq);
+                        continue;
+                }
+
+                if (NULL == (pf = pframe_alloc(o, pagenum))) {
+                        return -ENOMEM;
+                }
+                pframe_stats.ps_misses++;
+                if (0 > (ret = pframe_fill_ahead(pf))) {
+                        pframe_free(pf);
+                        return ret;
+                }
+                *result = pf;
+                return 0;
+        }
+}
+
+/*
+ * Starts filling those of the pages [pagenum, pagenum + npages) of 'o'
+ * which are not resident yet, without waiting for the fills to complete:
+ * the pages are allocated, marked busy and queued for pfilld, which fills
+ * runs of consecutive pages with one fillpages call and then wakes
+ * anyone waiting on them. Anyone who wants one of the pages simply uses
+ * pframe_get, which waits for it like for any other busy page, so a
+ * caller wanting many pages can start them all here and then wait once.
+ *
+ * This is only a hint: it does nothing for objects without a fillpages
+ * entry point (filling those does no I/O) or when called from pfilld
+ * itself (the pages would only be filled after the fill it is in the
+ * middle of), and it stops early when the queue is full or free memory
+ * is at the low mark. It never blocks.
+ *
+ * @return the number of fills started, or -ENOMEM if none could be
+ */
+int
+pframe_prefetch(struct mmobj *o, uint32_t pagenum, uint32_t npages)
+{
+        pframe_t *pf;
+        uint32_t i;
+        int started = 0;
+
+        if (NULL == o->mmo_ops->fillpages || curthr == pfilld_thr)
+                return 0;
+
+        for (i = 0; i < npages && pagenum + i >= pagenum; ++i) {
+                if (NULL != pftree_lookup(o, pagenum + i))
+                        continue;
+                if (PF_FILL_QUEUE == pfilld_count || page_free_count() <= nfreepages_low)
+                        break;
+                if (NULL == (pf = pframe_alloc(o, pagenum + i)))
+                        return started ? started : -ENOMEM;
+                pf->pf_flags |= PF_READAHEAD;
+                pframe_set_busy(pf);
+                pfilld_queue[(pfilld_head + pfilld_count++) % PF_FILL_QUEUE] = pf;
+                started++;
+        }
+
+        if (started > 0) {
+                pframe_stats.ps_ra_reads++;
+                pframe_stats.ps_ra_pages += started;
+                sched_broadcast_on(&pfilld_waitq);
+        }
+        return started;
 }
 
 /*
@@ -402,9 +1071,8 @@ pframe_pin(pframe_t *pf)
 		pf->pf_pincount++;
 		return;
 	};
-	list_remove(&(pf->pf_link));
+	pframe_list_remove(pf);
 	list_insert_tail(&pinned_list, &(pf->pf_link));
-	nallocated--;
 	npinned++;
 	pf->pf_pincount++;
 	return;
@@ -427,9 +1095,8 @@ pframe_unpin(pframe_t *pf)
 	pf->pf_pincount--;
     if(pf->pf_pincount == 0) {
     	list_remove(&(pf->pf_link));
-    	list_insert_tail(&alloc_list, &(pf->pf_link));
     	npinned--;
-    	nallocated++;
+    	pframe_list_insert(pf);
     	return;
     }
     return;
@@ -466,11 +1133,54 @@ pframe_dirty(pframe_t *pf)
         return ret;
 }
 
+#define pframe_is_clusterable(pf) \
+        (pframe_is_dirty(pf) && !pframe_is_busy(pf) && !pframe_is_pinned(pf))
+
+/*
+ * Collects the run of dirty pages around pf which can be written back in
+ * one request: pages of pf's object with consecutive page numbers which
+ * are dirty, not busy and not pinned, at most PF_CLEAN_CLUSTER of them.
+ * mmo_respages is in page number order, so these are pf's neighbours on it.
+ *
+ * @param cluster filled in with the run, in page number order
+ * @return the number of pages in the run, including pf
+ */
+static int
+pframe_gather_dirty(pframe_t *pf, pframe_t **cluster)
+{
+        list_t *respages = &pf->pf_obj->mmo_respages;
+        list_link_t *link;
+        pframe_t *first = pf, *p;
+        int n = 1;
+
+        for (link = pf->pf_olink.l_prev; link != respages && n < PF_CLEAN_CLUSTER;
+             link = link->l_prev, ++n) {
+                p = list_item(link, pframe_t, pf_olink);
+                if (p->pf_pagenum + 1 != first->pf_pagenum || !pframe_is_clusterable(p))
+                        break;
+                first = p;
+        }
+
+        cluster[0] = first;
+        for (link = first->pf_olink.l_next, n = 1; link != respages && n < PF_CLEAN_CLUSTER;
+             link = link->l_next) {
+                p = list_item(link, pframe_t, pf_olink);
+                if (p->pf_pagenum != cluster[n - 1]->pf_pagenum + 1 || !pframe_is_clusterable(p))
+                        break;
+                cluster[n++] = p;
+        }
+        return n;
+}
+
 /*
  * Clean a dirty page by writing it back to disk. Removes the dirty
  * bit of the page and updates the MMU entry.
  * The page must be dirty but unpinned.
  *
+ * If the page's object has a cleanpages entry point, the dirty unpinned
+ * pages adjacent to pf are written back along with it in the same request
+ * (see pframe_gather_dirty()).
+ *
  * This routine can block at the mmobj operation level.
  * @param pf the page to clean
  * @return 0 on success, -errno on failure
@@ -478,31 +1188,54 @@ pframe_dirty(pframe_t *pf)
 int
 pframe_clean(pframe_t *pf)
 {
-        int ret;
+        pframe_t *cluster[PF_CLEAN_CLUSTER];
+        mmobj_t *o = pf->pf_obj;
+        int ret, n, i;
 
         KASSERT(pframe_is_dirty(pf) && "Cleaning page that isn't dirty!");
         KASSERT(pf->pf_pincount == 0 && "Cleaning a pinned page!");
 
-        dbg(DBG_PFRAME, "cleaning page %d of obj %p\n", pf->pf_pagenum, pf->pf_obj);
+        if (NULL != o->mmo_ops->cleanpages) {
+                n = pframe_gather_dirty(pf, cluster);
+        } else {
+                cluster[0] = pf;
+                n = 1;
+        }
 
-        /*
-         * Clear the dirty bit *before* we potentially (depending on this
-         * particular object type's 'dirtypage' implementation) block so
-         * that if the page is dirtied again while we're writing it out,
-         * we won't (incorrectly) think the page has been fully cleaned.
-         */
-        pframe_clear_dirty(pf);
+        dbg(DBG_PFRAME, "cleaning pages %d-%d of obj %p\n", cluster[0]->pf_pagenum,
+            cluster[n - 1]->pf_pagenum, o);
 
-        /* Make sure a future write to the page will fault (and hence dirty it) */
-        tlb_flush((uintptr_t) pf->pf_addr);
-        pframe_remove_from_pts(pf);
+        for (i = 0; i < n; ++i) {
+                /*
+                 * Clear the dirty bit *before* we potentially (depending on this
+                 * particular object type's 'dirtypage' implementation) block so
+                 * that if the page is dirtied again while we're writing it out,
+                 * we won't (incorrectly) think the page has been fully cleaned.
+                 */
+                pframe_clear_dirty(cluster[i]);
 
-        pframe_set_busy(pf);
-        if ((ret = pf->pf_obj->mmo_ops->cleanpage(pf->pf_obj, pf)) < 0) {
-                pframe_set_dirty(pf);
+                /* Make sure a future write to the page will fault (and hence dirty it) */
+                tlb_flush((uintptr_t) cluster[i]->pf_addr);
+                pframe_remove_from_pts(cluster[i]);
+
+                pframe_set_busy(cluster[i]);
+        }
+
+        if (n > 1) {
+                ret = o->mmo_ops->cleanpages(o, cluster, n);
+        } else {
+                ret = o->mmo_ops->cleanpage(o, pf);
+        }
+        pframe_stats.ps_writes++;
+        pframe_stats.ps_written += n;
+        pframe_wb_account(n);
+
+        for (i = 0; i < n; ++i) {
+                if (ret < 0)
+                        pframe_set_dirty(cluster[i]);
+                pframe_clear_busy(cluster[i]);
+                sched_broadcast_on(&cluster[i]->pf_waitq);
         }
-        pframe_clear_busy(pf);
-        sched_broadcast_on(&pf->pf_waitq);
 
         return ret;
 }
@@ -526,24 +1259,24 @@ pframe_free(pframe_t *pf)
 
         mmobj_t *o = pf->pf_obj;
 
+        if (PF_READAHEAD & pf->pf_flags)
+                pframe_stats.ps_ra_wasted++;
 
         /* Flush the TLB */
         tlb_flush((uintptr_t) pf->pf_addr);
         /* Remove from all pagetables that map it */
         pframe_remove_from_pts(pf);
 
-        list_remove(&pf->pf_hlink);
+        pftree_remove(o, pf->pf_pagenum);
+        o->mmo_nrespages--;
+        list_remove(&pf->pf_olink);
 
         pf->pf_obj = NULL;
-        nallocated--;
-        list_remove(&pf->pf_link);
+        pframe_list_remove(pf);
 
         page_free(pf->pf_addr);
         slab_obj_free(pframe_allocator, pf);
 
-        o->mmo_nrespages--;
-        list_remove(&pf->pf_olink);
-
         /* Now that pf has effectively been freed, dereference the corresponding
          * object. We don't do this earlier as we are modifying the object's counts
          * and also because this op can block */
@@ -553,33 +1286,53 @@ pframe_free(pframe_t *pf)
 /*
  * Clean all allocated pages (that is, all pages that are not pinned and
  * not free). This is called by sync(2).
+ *
+ * Pages are taken off the head of alloc_list (and, with PF2Q, then the
+ * probationary list) one at a time and parked on a private list before we
+ * look at them, since cleaning blocks and the lists may change under us in
+ * the meantime. That way each page is visited once, however often we
+ * block; when we are done the parked pages are put back in front, in their
+ * original order. Pages written back as part of a neighbour's cluster
+ * are simply found to be clean by the time we get to them.
  */
 void
 pframe_clean_all()
 {
         pframe_t *pf;
+        list_t done;
+        list_t *list = &alloc_list;
         dbg(DBG_PFRAME, "pframe_clean_all: starting (this may take a while)\n");
 
-        /*
-         * Iterate from head of alloc_list to tail; This is a rough attempt to
-         * sync from least active to most active. Note that every time we block we
-         * need to start the loop over as the "current element" pf may have been
-         * moved or removed in the meantime (our list has no multithreaded
-         * integrity)
-         */
-list_start:
-        list_iterate_begin(&alloc_list, pf, pframe_t, pf_link) {
-                KASSERT(!pframe_is_pinned(pf));
-                KASSERT(!pframe_is_free(pf));
-                if (pframe_is_busy(pf)) {
-                        sched_sleep_on(&pf->pf_waitq);
-                        goto list_start;
+        list_init(&done);
+        while (1) {
+                while (!list_empty(list)) {
+                        pf = list_head(list, pframe_t, pf_link);
+                        KASSERT(!pframe_is_pinned(pf));
+                        KASSERT(!pframe_is_free(pf));
+                        if (pframe_is_busy(pf)) {
+                                /* it may be gone when we wake up */
+                                sched_sleep_on(&pf->pf_waitq);
+                                continue;
+                        }
+                        list_remove(&pf->pf_link);
+                        list_insert_tail(&done, &pf->pf_link);
+                        if (pframe_is_dirty(pf))
+                                pframe_clean(pf);
                 }
-                if (pframe_is_dirty(pf)) {
-                        pframe_clean(pf);
-                        goto list_start;
+
+                while (!list_empty(&done)) {
+                        list_link_t *link = done.l_prev;
+                        list_remove(link);
+                        list_insert_head(list, link);
                 }
-        } list_iterate_end();
+#ifdef __PF2Q__
+                if (&alloc_list == list) {
+                        list = &probation_list;
+                        continue;
+                }
+#endif
+                break;
+        }
 
         /* In theory, this function might never terminate (if new pages are
          * constantly being added at the same time). That's why the user shouldn't
@@ -587,27 +1340,298 @@ list_start:
         dbg(DBG_PFRAME, "pframe_clean_all: completed!\n");
 }
 
+/*
+ * State for a walk over the reverse map of a page frame. Entries removed
+ * from the current address space are collected into one range of
+ * virtual frames so the TLB is flushed once per walk; other address
+ * spaces are flushed when they are switched to.
+ */
+typedef struct pframe_rmap_walk {
+        uintptr_t       pw_paddr;       /* physical address of the page */
+        uint32_t        pw_lovfn;       /* [lowest, */
+        uint32_t        pw_hivfn;       /*  highest) vfn to flush */
+        int             pw_referenced;
+} pframe_rmap_walk_t;
+
+static void
+pframe_rmap_walk_init(pframe_rmap_walk_t *walk, pframe_t *pf)
+{
+        walk->pw_paddr = pt_virt_to_phys((uintptr_t) pf->pf_addr);
+        walk->pw_lovfn = 0;
+        walk->pw_hivfn = 0;
+        walk->pw_referenced = 0;
+}
+
+static void
+pframe_rmap_walk_invalidate(pframe_rmap_walk_t *walk, pagedir_t *pd, uint32_t vfn)
+{
+        if (pd != pt_get())
+                return;
+        if (walk->pw_lovfn == walk->pw_hivfn) {
+                walk->pw_lovfn = vfn;
+                walk->pw_hivfn = vfn + 1;
+        } else {
+                walk->pw_lovfn = MIN(walk->pw_lovfn, vfn);
+                walk->pw_hivfn = MAX(walk->pw_hivfn, vfn + 1);
+        }
+}
+
+static void
+pframe_rmap_walk_flush(pframe_rmap_walk_t *walk)
+{
+        uint32_t count = walk->pw_hivfn - walk->pw_lovfn;
+
+        if (0 == count)
+                return;
+        if (count > PF_TLB_FLUSH_MAX)
+                tlb_flush_all();
+        else
+                tlb_flush_range((uintptr_t) PN_TO_ADDR(walk->pw_lovfn), count);
+}
+
+static void
+pframe_rmap_unmap(vmarea_t *vma, uint32_t vfn, void *arg)
+{
+        pframe_rmap_walk_t *walk = (pframe_rmap_walk_t *) arg;
+
+        if (NULL != vma->vma_vmmap->vmm_proc) {
+                pagedir_t *pd = vma->vma_vmmap->vmm_proc->p_pagedir;
+                pt_unmap(pd, (uintptr_t) PN_TO_ADDR(vfn));
+                pframe_rmap_walk_invalidate(walk, pd, vfn);
+        }
+}
+
 /* Remove a page frame from the page tables of all processes that map it
- * To do that, traverse all processes that map the given page frame into
- * their address space, and zero the corresponding address entry.
+ * To do that, look up the vm_areas of the bottom object containing the
+ * page in its reverse map, and zero the corresponding address entry.
  */
 void
 pframe_remove_from_pts(pframe_t *pf)
 {
-        vmarea_t *vma;
-        list_iterate_begin(mmobj_bottom_vmas(pf->pf_obj), vma, vmarea_t, vma_olink) {
-                /* Get the virtual address in the area corresponding to this pf */
-                if ((pf->pf_pagenum >= vma->vma_off)
-                    && (pf->pf_pagenum < vma->vma_off + (vma->vma_end - vma->vma_start))) {
-                        uintptr_t vaddr = (uintptr_t) PN_TO_ADDR(vma->vma_start + pf->pf_pagenum - vma->vma_off);
-                        /* And unmap it from that area's proc */
-                        if (NULL != vma->vma_vmmap->vmm_proc) {
-                                pt_unmap(vma->vma_vmmap->vmm_proc->p_pagedir, vaddr);
+        pframe_rmap_walk_t walk;
+
+        pframe_rmap_walk_init(&walk, pf);
+        vmarea_rmap_iterate(pf->pf_obj, pf->pf_pagenum, pframe_rmap_unmap, &walk);
+        pframe_rmap_walk_flush(&walk);
+}
+
+static void
+pframe_rmap_clear_accessed(vmarea_t *vma, uint32_t vfn, void *arg)
+{
+        pframe_rmap_walk_t *walk = (pframe_rmap_walk_t *) arg;
+
+        if (NULL != vma->vma_vmmap->vmm_proc) {
+                pagedir_t *pd = vma->vma_vmmap->vmm_proc->p_pagedir;
+                if (pt_test_and_clear_accessed(pd, (uintptr_t) PN_TO_ADDR(vfn), walk->pw_paddr)) {
+                        walk->pw_referenced = 1;
+                        pframe_rmap_walk_invalidate(walk, pd, vfn);
+                }
+        }
+}
+
+/*
+ * Tests and clears the referenced state of a page: its PF_REFERENCED flag
+ * and the accessed bits of all user mappings of it, found the same way
+ * pframe_remove_from_pts finds them. Only entries which actually map this
+ * page frame are considered, since a shadow object higher up may have its
+ * own copy mapped at the same address.
+ *
+ * @return nonzero if the page was referenced since the last call
+ */
+static int
+pframe_test_and_clear_referenced(pframe_t *pf)
+{
+        pframe_rmap_walk_t walk;
+
+        pframe_rmap_walk_init(&walk, pf);
+        walk.pw_referenced = pframe_is_referenced(pf);
+        pframe_clear_referenced(pf);
+        vmarea_rmap_iterate(pf->pf_obj, pf->pf_pagenum, pframe_rmap_clear_accessed, &walk);
+        pframe_rmap_walk_flush(&walk);
+
+        return walk.pw_referenced;
+}
+
+size_t
+pframe_info(const void *arg, char *buf, size_t osize)
+{
+        size_t size = osize;
+        uint32_t lookups = pframe_stats.ps_hits + pframe_stats.ps_misses;
+
+        iprintf(&buf, &size, "allocated:    %d\n", nallocated);
+        iprintf(&buf, &size, "pinned:       %d\n", npinned);
+        iprintf(&buf, &size, "free:         %u\n", page_free_count());
+        iprintf(&buf, &size, "watermarks:   min %u low %u high %u\n",
+                nfreepages_min, nfreepages_low, nfreepages_high);
+        iprintf(&buf, &size, "readahead:    %u prefetches, %u pages\n",
+                pframe_stats.ps_ra_reads, pframe_stats.ps_ra_pages);
+        iprintf(&buf, &size, "  window:     %d (max %d)\n",
+                pframe_stats.ps_ra_window, PF_READAHEAD_MAX);
+        iprintf(&buf, &size, "  used:       %u\n", pframe_stats.ps_ra_hits);
+        iprintf(&buf, &size, "  wasted:     %u\n", pframe_stats.ps_ra_wasted);
+        iprintf(&buf, &size, "async fills:  %u requests, %u failed pages, %d queued\n",
+                pframe_stats.ps_fills, pframe_stats.ps_fill_errors, pfilld_count);
+        iprintf(&buf, &size, "writebacks:   %u requests, %u pages (%u per request)\n",
+                pframe_stats.ps_writes, pframe_stats.ps_written,
+                pframe_stats.ps_writes ? pframe_stats.ps_written / pframe_stats.ps_writes : 0);
+        pframe_wb_account(0);
+        iprintf(&buf, &size, "  rate:       %u pages/s\n", pframe_stats.ps_wb_rate);
+        iprintf(&buf, &size, "wakeups:      %u\n", pframe_stats.ps_wakeups);
+        iprintf(&buf, &size, "stalls:       %u, woken %u\n",
+                pframe_stats.ps_stalls, pframe_stats.ps_stall_wakes);
+        iprintf(&buf, &size, "hits:         %u\n", pframe_stats.ps_hits);
+        iprintf(&buf, &size, "misses:       %u\n", pframe_stats.ps_misses);
+        iprintf(&buf, &size, "hit rate:     %u%%\n",
+                lookups ? pframe_stats.ps_hits * 100 / lookups : 0);
+        iprintf(&buf, &size, "scanned:      %u\n", pframe_stats.ps_scanned);
+        iprintf(&buf, &size, "referenced:   %u\n", pframe_stats.ps_referenced);
+        iprintf(&buf, &size, "evicted:      %u\n", pframe_stats.ps_evicted);
+        /* every stall is a switch away from the allocator and every
+         * wakeup one back to it */
+        iprintf(&buf, &size, "  switches:   %u per 100 pages\n",
+                pframe_stats.ps_evicted
+                ? (pframe_stats.ps_stalls + pframe_stats.ps_stall_wakes) * 100 / pframe_stats.ps_evicted
+                : 0);
+#ifdef __PF2Q__
+        iprintf(&buf, &size, "policy:       2Q\n");
+        iprintf(&buf, &size, "probationary: %d\n", nprobation);
+        iprintf(&buf, &size, "  evicted:    %u\n", pframe_stats.ps_probation_evicted);
+        iprintf(&buf, &size, "ghost hits:   %u\n", pframe_stats.ps_ghost_hits);
+#else
+        iprintf(&buf, &size, "policy:       CLOCK\n");
+#endif
+
+        return size;
+}
+
+/* ------------------------------------------------------------------ */
+/* -------------------------- FILL DAEMON --------------------------- */
+/* ------------------------------------------------------------------ */
+
+/*
+ * Takes the page at the head of the fill queue off, along with the pages
+ * queued right behind it which continue the same run in the same object.
+ *
+ * @return the number of pages put in cluster
+ */
+static int
+pfilld_dequeue(pframe_t **cluster)
+{
+        int n = 0;
+
+        KASSERT(0 < pfilld_count);
+        do {
+                cluster[n++] = pfilld_queue[pfilld_head];
+                pfilld_head = (pfilld_head + 1) % PF_FILL_QUEUE;
+                pfilld_count--;
+        } while (0 < pfilld_count && n < PF_READAHEAD_MAX
+                 && pfilld_queue[pfilld_head]->pf_obj == cluster[0]->pf_obj
+                 && pfilld_queue[pfilld_head]->pf_pagenum == cluster[n - 1]->pf_pagenum + 1);
+        return n;
+}
+
+/*
+ * Takes pf off the fill queue, wherever it is, keeping the other pages in
+ * order.
+ *
+ * @return 1 if pf was queued, 0 if not
+ */
+static int
+pfilld_take(pframe_t *pf)
+{
+        int i, j;
+
+        for (i = 0; i < pfilld_count; ++i) {
+                if (pf != pfilld_queue[(pfilld_head + i) % PF_FILL_QUEUE])
+                        continue;
+                for (j = i; j + 1 < pfilld_count; ++j)
+                        pfilld_queue[(pfilld_head + j) % PF_FILL_QUEUE] =
+                                pfilld_queue[(pfilld_head + j + 1) % PF_FILL_QUEUE];
+                pfilld_count--;
+                return 1;
+        }
+        return 0;
+}
+
+/*
+ * Marks a page taken off the fill queue as no longer busy and wakes its
+ * waiters; if it could not be filled it is freed, and the waiters will
+ * look it up again and miss.
+ */
+static void
+pfilld_finish(pframe_t *pf, int filled)
+{
+        pframe_clear_busy(pf);
+        sched_broadcast_on(&pf->pf_waitq);
+        if (!filled) {
+                pframe_stats.ps_fill_errors++;
+                pf->pf_flags &= ~PF_READAHEAD;
+                pframe_free(pf);
+        }
+}
+
+/*
+ * The fill daemon fills the pages queued by pframe_prefetch. A run of
+ * pages is filled with one fillpages call; if that fails the pages are
+ * retried one by one so that a bad page only costs itself. Pages which
+ * cannot be filled are freed once their waiters have been woken up.
+ * Both arguments unused.
+ */
+static void *
+pfilld_run(int arg1, void *arg2)
+{
+        pframe_t *cluster[PF_READAHEAD_MAX];
+        int filled[PF_READAHEAD_MAX];
+        int n, i, ret;
+
+        while (1) {
+                while (0 < pfilld_count) {
+                        n = pfilld_dequeue(cluster);
+                        mmobj_t *o = cluster[0]->pf_obj;
+
+                        pframe_stats.ps_fills++;
+                        if (1 == n) {
+                                ret = o->mmo_ops->fillpage(o, cluster[0]);
+                        } else {
+                                ret = o->mmo_ops->fillpages(o, cluster, n);
                         }
+                        for (i = 0; i < n; ++i) {
+                                if (0 <= ret) {
+                                        filled[i] = 1;
+                                } else if (1 < n) {
+                                        pframe_stats.ps_fills++;
+                                        filled[i] = (0 <= o->mmo_ops->fillpage(o, cluster[i]));
+                                } else {
+                                        filled[i] = 0;
+                                }
+                        }
+
+                        for (i = 0; i < n; ++i)
+                                pfilld_finish(cluster[i], filled[i]);
                 }
+                if (sched_cancellable_sleep_on(&pfilld_waitq))
+                        kthread_exit((void *)0);
+        }
+        return NULL;
+}
 
-        } list_iterate_end();
+static __attribute__((unused)) void
+pfilld_init(void)
+{
+        sched_queue_init(&pfilld_waitq);
+
+        KASSERT(curproc && (PID_IDLE == curproc->p_pid)
+                && "should be calling this from idleproc");
+        pfilld = proc_create("pfilld");
+        KASSERT(NULL != pfilld);
+        pfilld_thr = kthread_create(pfilld, pfilld_run, 0, NULL);
+        KASSERT(NULL != pfilld_thr);
+
+        sched_set_priority(pfilld_thr, PRIO_DAEMON);
+        sched_make_runnable(pfilld_thr);
 }
+init_func(pfilld_init);
+init_depends(sched_init);
 
 /* ------------------------------------------------------------------ */
 /* ------------------------- PAGEOUT DAEMON ------------------------- */
@@ -632,6 +1656,7 @@ pageoutd_init(void)
         pageoutd_thr = kthread_create(pageoutd, pageoutd_run, 0, NULL);
         KASSERT(NULL != pageoutd_thr);
 
+        sched_set_priority(pageoutd_thr, PRIO_DAEMON);
         sched_make_runnable(pageoutd_thr);
 }
 init_func(pageoutd_init);
@@ -649,50 +1674,128 @@ pageoutd_exit()
 }
 
 /*
- * The pageout daemon, when run, gets the least-recently-requested page from the
- * list of pages which are available to be paged out. Make sure to check if the
- * page is busy before yanking it. If the page you select is dirty, make sure
- * to clean it before yanking it. Finally, go back to sleep after having paged
- * out the appropriate page.
+ * Returns the list pageoutd should reclaim from next. Without PF2Q this is
+ * always alloc_list. With PF2Q it is the probationary list while that holds
+ * more than its 1/2^PF_2Q_KIN_SHIFT share of the allocated pages, or when
+ * there are no protected pages left.
+ */
+static list_t *
+pageoutd_victim_list(void)
+{
+#ifdef __PF2Q__
+        if (!list_empty(&probation_list)
+            && (list_empty(&alloc_list)
+                || nprobation > (nallocated >> PF_2Q_KIN_SHIFT)))
+                return &probation_list;
+#endif
+        return &alloc_list;
+}
+
+/*
+ * The pageout daemon, when run, sweeps the clock hand over the list of pages
+ * which are available to be paged out. Pages which have been referenced
+ * since the hand last passed get a second chance at the tail of the list.
+ * With PF2Q, probationary pages are reclaimed in FIFO order instead.
+ * Make sure to check if the page is busy before yanking it. If the page you
+ * select is dirty, make sure to clean it before yanking it. Finally, go back
+ * to sleep after having paged out the appropriate page.
  * Both arguments unused.
  */
 static void *
 pageoutd_run(int arg1, void *arg2)
 {
         while (1) {
+                /* allocators woken this round, each for a page */
+                uint32_t nwoken = 0;
+                uint32_t nevicted = 0;
+                int exhausted = 0;
+                uint32_t nfree;
+
                 KASSERT(nallocated >= 0);
-                while ((!pageoutd_target_met()) && (!list_empty(&alloc_list))) {
+                /* The kernel's caches take their share of the shortfall,
+                 * weighed against the resident pages we could evict */
+                if (!pageoutd_target_met())
+                        shrink_caches(nfreepages_high - page_free_count(), nallocated);
+                while (!pageoutd_target_met()) {
                         pframe_t *pf;
+                        list_t *list = pageoutd_victim_list();
 
-                        /* obtain least-recently-requested page: */
-                        pf = list_head(&alloc_list, pframe_t, pf_link);
+                        /* nallocated may be nonzero with every page parked
+                         * by pframe_clean_all, so look at the list itself */
+                        if (list_empty(list)) {
+                                exhausted = 1;
+                                break;
+                        }
+
+                        /* obtain page under the clock hand: */
+                        pf = list_head(list, pframe_t, pf_link);
 
                         if (pframe_is_busy(pf)) {
                                 sched_sleep_on(&pf->pf_waitq);
+                                continue;
+                        }
+                        pframe_stats.ps_scanned++;
+                        if (&alloc_list == list
+                            && pframe_test_and_clear_referenced(pf)) {
+                                /* second chance */
+                                pframe_stats.ps_referenced++;
+                                list_remove(&pf->pf_link);
+                                list_insert_tail(&alloc_list, &pf->pf_link);
                         } else if (pframe_is_dirty(pf)) {
                                 pframe_clean(pf);
                         } else {
-                                /* it's not busy, it's clean, and it's
-                                 * least-recently-requested; reclaim it: */
+                                /* it's not busy, it's clean, and it hasn't
+                                 * been referenced in a full sweep; reclaim it: */
+                                pframe_stats.ps_evicted++;
+#ifdef __PF2Q__
+                                if (&probation_list == list) {
+                                        pframe_stats.ps_probation_evicted++;
+                                        pframe_ghost_add(pf->pf_obj, pf->pf_pagenum);
+                                }
+#endif
                                 pframe_free(pf);
+                                nevicted++;
+                                /* don't keep allocators waiting until we
+                                 * are all the way up at the high mark, but
+                                 * only wake one for each page above min */
+                                if (!pageoutd_must_wait())
+                                        nwoken += sched_wakeup_n(&alloc_waitq, 1);
                         }
                 }
 
-                /*   release the thundering herd... */
-                sched_broadcast_on(&alloc_waitq);
+                if (0 == nevicted || exhausted) {
+                        /* waiting for us will not get anyone a page, so
+                         * let them all retry; whoever still finds memory
+                         * short wakes us again */
+                        sched_broadcast_on(&alloc_waitq);
+                } else {
+                        /* wake the rest of the allocators the free pages
+                         * are enough for; those woken above have not run
+                         * yet */
+                        nfree = page_free_count();
+                        if (nfree > nfreepages_min + nwoken)
+                                nwoken += sched_wakeup_n(&alloc_waitq,
+                                                         nfree - nfreepages_min - nwoken);
+                }
+                pframe_stats.ps_stall_wakes += nwoken;
 
+                dbginfo(DBG_PFRAME, pframe_info, NULL);
                 dbg(DBG_PFRAME, "PAGEOUT DEMAON: Falling asleep\n");
                 dbg(DBG_PFRAME, "PAGEOUT DEMAON: "
-                    "nfreepages_target=|%d| "
+                    "nfreepages_high=|%d| "
+					"nfreepages_low=|%d| "
 					"nfreepages_min=|%d| "
-					"page_free_count=|%d|\n", nfreepages_target, nfreepages_min, page_free_count());
+					"page_free_count=|%d|\n", nfreepages_high, nfreepages_low,
+					nfreepages_min, page_free_count());
                 if (sched_cancellable_sleep_on(&pageoutd_waitq))
                         kthread_exit((void *)0);
                 dbg(DBG_PFRAME, "PAGEOUT DEMAON: Waking up\n");
                 dbg(DBG_PFRAME, "PAGEOUT DEMAON: "
-                    "nfreepages_target=|%d| "
+                    "nfreepages_high=|%d| "
+					"nfreepages_low=|%d| "
 					"nfreepages_min=|%d| "
-					"page_free_count=|%d|\n", nfreepages_target, nfreepages_min, page_free_count());
+					"page_free_count=|%d|\n", nfreepages_high, nfreepages_low,
+					nfreepages_min, page_free_count());
         }
         return NULL;
 }
@@ -0,0 +1,90 @@
+/******************************************************************************/
+/* Important Spring 2015 CSCI 402 usage information:                          */
+/*                                                                            */
+/* This fils is part of CSCI 402 kernel programming assignments at USC.       */
+/* Please understand that you are NOT permitted to distribute or publically   */
+/*         display a copy of this file (or ANY PART of it) for any reason.    */
+/* If anyone (including your prospective employer) asks you to post the code, */
+/*         you must inform them that you do NOT have permissions to do so.    */
+/* You are also NOT permitted to remove or alter this comment block.          */
+/* If this comment block is removed or altered in a submitted file, 20 points */
+/*         will be deducted.                                                  */
+/******************************************************************************/
+
+#include "types.h"
+#include "kernel.h"
+
+#include "mm/shrinker.h"
+
+#include "util/list.h"
+#include "util/debug.h"
+#include "util/printf.h"
+
+/* Shrinkers register from slab_init() on, before any init function runs,
+ * so the list starts out initialized. */
+static list_t shrinker_list = { &shrinker_list, &shrinker_list };
+
+void
+shrinker_register(shrinker_t *sh)
+{
+        KASSERT(NULL != sh->sh_count && NULL != sh->sh_scan);
+        sh->sh_calls = 0;
+        sh->sh_freed = 0;
+        list_insert_tail(&shrinker_list, &sh->sh_link);
+}
+
+void
+shrinker_unregister(shrinker_t *sh)
+{
+        KASSERT(list_link_is_linked(&sh->sh_link));
+        list_remove(&sh->sh_link);
+}
+
+uint32_t
+shrink_caches(uint32_t target, uint32_t npages_other)
+{
+        shrinker_t *sh;
+        uint32_t total = npages_other;
+        uint32_t nfreed = 0;
+
+        list_iterate_begin(&shrinker_list, sh, shrinker_t, sh_link) {
+                total += sh->sh_count(sh);
+        } list_iterate_end();
+        if (0 == total)
+                return 0;
+
+        list_iterate_begin(&shrinker_list, sh, shrinker_t, sh_link) {
+                uint32_t count, share, freed;
+
+                if (0 == (count = sh->sh_count(sh)))
+                        continue;
+                /* Rounded up, so every shrinker with something to give
+                 * gives at least a page */
+                share = (target * count + total - 1) / total;
+                share = MIN(share, count);
+
+                freed = sh->sh_scan(sh, share);
+                sh->sh_calls++;
+                sh->sh_freed += freed;
+                nfreed += freed;
+                dbg(DBG_MM, "shrinker \"%s\": asked for %u of %u pages, freed %u\n",
+                    sh->sh_name, share, count, freed);
+        } list_iterate_end();
+
+        return nfreed;
+}
+
+size_t
+shrinker_info(const void *arg, char *buf, size_t osize)
+{
+        size_t size = osize;
+        shrinker_t *sh;
+
+        iprintf(&buf, &size, "%-16s %8s %8s %8s\n", "name", "now", "calls", "freed");
+        list_iterate_begin(&shrinker_list, sh, shrinker_t, sh_link) {
+                iprintf(&buf, &size, "%-16s %8u %8u %8u\n", sh->sh_name,
+                        sh->sh_count(sh), sh->sh_calls, sh->sh_freed);
+        } list_iterate_end();
+
+        return size;
+}
@@ -25,14 +25,23 @@
  */
 
 #include "types.h"
+#include "errno.h"
 
 #include "mm/mm.h"
 #include "mm/slab.h"
+#include "mm/kmalloc.h"
+#include "mm/shrinker.h"
 #include "mm/page.h"
 
 #include "util/gdb.h"
+#include "util/list.h"
 #include "util/string.h"
 #include "util/debug.h"
+#include "util/printf.h"
+#include "util/init.h"
+
+#include "drivers/bytedev.h"
+#include "drivers/dev.h"
 
 #ifdef SLAB_REDZONE
 #define front_rz(obj)           (*(uintptr_t*)(obj))
@@ -51,19 +60,62 @@
 #endif
 
 struct slab {
-        struct slab             *s_next;       /* link on list of slabs */
+        list_link_t              s_link;       /* link on one of the allocator's lists */
         int                      s_inuse;      /* number of allocated objs */
         void                    *s_free;       /* head of obj free list */
         void                    *s_addr;       /* start address */
+        void                    *s_objs;       /* first obj, s_addr plus color */
+};
+
+/*
+ * Magazines cache freed objects in front of the slabs, after Bonwick's
+ * "Magazines and Vmem". A magazine is a stack of up to SLAB_MAG_ROUNDS
+ * object pointers; each allocator has a loaded and a previous magazine,
+ * and a depot of full and empty ones, so most allocs and frees are a
+ * pop or push that never touches a slab or bufctl.
+ */
+#define SLAB_MAG_ROUNDS                 15
+#define SLAB_DEPOT_MAX                  4       /* full magazines kept in depot */
+#define SLAB_MAG_MAX_OBJSIZE            1024    /* larger objects skip the magazines */
+
+struct slab_magazine {
+        struct slab_magazine    *m_next;        /* link on a depot list */
+        int                      m_rounds;      /* number of objs in m_objs */
+        void                    *m_objs[SLAB_MAG_ROUNDS];
 };
 
 struct slab_allocator {
         struct slab_allocator   *sa_next;       /* link on list of slab allocators */
         const char              *sa_name;       /* user-provided name */
         size_t                   sa_objsize;    /* object size */
-        struct slab             *sa_slabs;      /* head of slab list */
+        list_t                   sa_partial;    /* slabs with free and used objs */
+        list_t                   sa_full;       /* slabs with no free objs */
+        list_t                   sa_empty;      /* slabs with no used objs */
         int                      sa_order;      /* npages = (1 << order) */
         int                      sa_slab_nobjs; /* number of objs per slab */
+        size_t                   sa_lead;       /* bytes before obj 0 that align it */
+        size_t                   sa_color_step; /* slab start offsets differ by this */
+        size_t                   sa_color_max;  /* largest start offset */
+        size_t                   sa_color_next; /* start offset of the next slab */
+        slab_ctor_t              sa_ctor;       /* run on each obj when a slab grows */
+        slab_dtor_t              sa_dtor;       /* run on each obj when a slab is freed */
+
+        int                      sa_magazines;  /* true if objs are cached in magazines */
+        struct slab_magazine    *sa_loaded;     /* magazine allocs and frees use */
+        struct slab_magazine    *sa_previous;   /* the one used before it */
+        struct slab_magazine    *sa_depot_full;
+        struct slab_magazine    *sa_depot_empty;
+        int                      sa_ndepot_full;
+
+        size_t                   sa_size;       /* obj size asked for */
+        uint32_t                 sa_allocs;     /* slab_obj_alloc calls */
+        uint32_t                 sa_frees;      /* slab_obj_free calls */
+        uint32_t                 sa_mag_allocs; /* allocs served by a magazine */
+        uint32_t                 sa_mag_frees;  /* frees taken by a magazine */
+        uint32_t                 sa_flushed;    /* objs flushed back to slabs */
+        uint32_t                 sa_nslabs;     /* slabs held */
+        uint32_t                 sa_grows;      /* slabs created */
+        uint32_t                 sa_reclaims;   /* slabs freed by reclaim */
 };
 
 struct slab_bufctl {
@@ -95,6 +147,9 @@ static struct slab_allocator *slab_allocators = NULL;
 /* Special case - allocator for allocation of slab_allocator objects. */
 static struct slab_allocator slab_allocator_allocator;
 
+/* Special case - allocator for magazines, which of course has none. */
+static struct slab_allocator slab_magazine_allocator;
+
 /*
  * This constant defines how many orders of magnitude (in page block
  * sizes) we'll search for an optimal slab size (past the smallest
@@ -103,28 +158,29 @@ static struct slab_allocator slab_allocator_allocator;
 #define SLAB_MAX_ORDER                  5
 
 static size_t
-_slab_size(size_t objsize, size_t nobjs)
+_slab_size(struct slab_allocator *allocator, size_t nobjs)
 {
-        return (nobjs * (objsize + sizeof(struct slab_bufctl))
+        return (allocator->sa_lead
+                + nobjs * (allocator->sa_objsize + sizeof(struct slab_bufctl))
                 + sizeof(struct slab));
 }
 
 static int
-_slab_nobjs(size_t objsize, size_t order)
+_slab_nobjs(struct slab_allocator *allocator, size_t order)
 {
-        return (((PAGE_SIZE << order) - sizeof(struct slab))
-                / (objsize + sizeof(struct slab_bufctl)));
+        return (((PAGE_SIZE << order) - sizeof(struct slab) - allocator->sa_lead)
+                / (allocator->sa_objsize + sizeof(struct slab_bufctl)));
 }
 
 static int
-_slab_waste(size_t objsize, int order)
+_slab_waste(struct slab_allocator *allocator, int order)
 {
         /* Waste is defined as the amount of unused space in the page
          * block, that is the number of bytes in the page block minus
          * the optimal slab size for that particular block size.
          */
         return ((PAGE_SIZE << order)
-                - _slab_size(objsize, _slab_nobjs(objsize, order)));
+                - _slab_size(allocator, _slab_nobjs(allocator, order)));
 }
 
 static void
@@ -138,7 +194,7 @@ _calc_slab_size(struct slab_allocator *allocator)
         int waste;
 
         /* Find the minimum page block size that this slab requires. */
-        minsize = _slab_size(allocator->sa_objsize, 1);
+        minsize = _slab_size(allocator, 1);
         for (minorder = 0; minorder < PAGE_NSIZES; minorder++)
                 if ((int)(PAGE_SIZE << minorder) >= minsize)
                         break;
@@ -147,7 +203,7 @@ _calc_slab_size(struct slab_allocator *allocator)
 
         /* Start the search with the minimum block size for this slab. */
         best_order = minorder;
-        best_waste = _slab_waste(allocator->sa_objsize, minorder);
+        best_waste = _slab_waste(allocator, minorder);
 
         dbg(DBG_MM, "calc_slab_size: minorder %d, waste %d\n", minorder, best_waste);
 
@@ -156,7 +212,7 @@ _calc_slab_size(struct slab_allocator *allocator)
          * of pages per slab.
          */
         for (order = minorder + 1; order < SLAB_MAX_ORDER; order++) {
-                if ((waste = _slab_waste(allocator->sa_objsize, order)) < best_waste) {
+                if ((waste = _slab_waste(allocator, order)) < best_waste) {
                         best_waste = waste;
                         best_order = order;
                         dbg(DBG_MM, "calc_slab_size: replacing with order %d, waste %d\n",
@@ -167,12 +223,23 @@ _calc_slab_size(struct slab_allocator *allocator)
         /* Finally, the best page block size wins.
         */
         allocator->sa_order = best_order;
-        allocator->sa_slab_nobjs = _slab_nobjs(allocator->sa_objsize, best_order);
+        allocator->sa_slab_nobjs = _slab_nobjs(allocator, best_order);
+
+        /* The waste is left over at the end of every slab. Rather than
+         * have the objects of all slabs start at the same offset in
+         * their pages, and so compete for the same cache sets, slabs
+         * start at each multiple of sa_color_step within it in turn. */
+        allocator->sa_color_max = best_waste - best_waste % allocator->sa_color_step;
+        allocator->sa_color_next = 0;
 }
 
 static void
-_allocator_init(struct slab_allocator *allocator, const char *name, size_t size)
+_allocator_init(struct slab_allocator *allocator, const char *name,
+                size_t size, size_t align)
 {
+        KASSERT(0 == (align & (align - 1)) && "alignment not a power of two");
+        allocator->sa_size = size;
+
 #ifdef SLAB_REDZONE
         /*
          * Add space for the front and rear red-zones.
@@ -180,12 +247,48 @@ _allocator_init(struct slab_allocator *allocator, const char *name, size_t size)
         size += 2 * sizeof(SLAB_REDZONE);
 #endif
 
+        /*
+         * To keep every object aligned pad them so that objects and their
+         * bufctls take a multiple of align, and start the first object far
+         * enough into the slab that the pointer handed out (which is past
+         * the front red-zone) is aligned.
+         */
+        allocator->sa_lead = 0;
+        if (align > 1) {
+                size = ((size + sizeof(struct slab_bufctl) + align - 1) & ~(align - 1))
+                       - sizeof(struct slab_bufctl);
+#ifdef SLAB_REDZONE
+                allocator->sa_lead = (align - sizeof(SLAB_REDZONE) % align) % align;
+#endif
+        }
+        allocator->sa_color_step = MAX(align, SLAB_CACHE_LINE);
+
         if (!name)
                 name = "<unnamed>";
 
         allocator->sa_name = name;
         allocator->sa_objsize = size;
-        allocator->sa_slabs = NULL;
+        list_init(&allocator->sa_partial);
+        list_init(&allocator->sa_full);
+        list_init(&allocator->sa_empty);
+        allocator->sa_ctor = NULL;
+        allocator->sa_dtor = NULL;
+        allocator->sa_magazines = (size <= SLAB_MAG_MAX_OBJSIZE
+                                   && allocator != &slab_allocator_allocator
+                                   && allocator != &slab_magazine_allocator);
+        allocator->sa_loaded = NULL;
+        allocator->sa_previous = NULL;
+        allocator->sa_depot_full = NULL;
+        allocator->sa_depot_empty = NULL;
+        allocator->sa_ndepot_full = 0;
+        allocator->sa_allocs = 0;
+        allocator->sa_frees = 0;
+        allocator->sa_mag_allocs = 0;
+        allocator->sa_mag_frees = 0;
+        allocator->sa_flushed = 0;
+        allocator->sa_nslabs = 0;
+        allocator->sa_grows = 0;
+        allocator->sa_reclaims = 0;
         _calc_slab_size(allocator);
 
         /* Add cache to global cache list. */
@@ -197,25 +300,87 @@ _allocator_init(struct slab_allocator *allocator, const char *name, size_t size)
         dbgq(DBG_MM, "  Object Size:   %d\n", allocator->sa_objsize);
         dbgq(DBG_MM, "  Order:         %d\n", allocator->sa_order);
         dbgq(DBG_MM, "  Slab Capacity: %d\n", allocator->sa_slab_nobjs);
+        dbgq(DBG_MM, "  Colors:        %d\n",
+             allocator->sa_color_max / allocator->sa_color_step + 1);
 }
 
 struct slab_allocator *
-slab_allocator_create(const char *name, size_t size) {
+slab_allocator_create(const char *name, size_t size, size_t align,
+                      slab_ctor_t ctor, slab_dtor_t dtor) {
         struct slab_allocator *allocator;
 
         allocator = (struct slab_allocator *) slab_obj_alloc(&slab_allocator_allocator);
         if (!allocator)
                 return NULL;
 
-        _allocator_init(allocator, name, size);
+        _allocator_init(allocator, name, size, align);
+        allocator->sa_ctor = ctor;
+        allocator->sa_dtor = dtor;
         return allocator;
 }
 
 
+/*
+ * Runs the destructor on every object of an empty slab and frees its
+ * pages. Returns the number of pages freed.
+ */
+static int
+_slab_destroy(struct slab_allocator *allocator, struct slab *slab)
+{
+        void *obj;
+        int ii;
+
+        KASSERT(0 == slab->s_inuse);
+        if (NULL != allocator->sa_dtor) {
+                obj = slab->s_objs;
+                for (ii = 0; ii < allocator->sa_slab_nobjs; ii++) {
+#ifdef SLAB_REDZONE
+                        allocator->sa_dtor((void *)((uintptr_t)obj + sizeof(SLAB_REDZONE)));
+#else
+                        allocator->sa_dtor(obj);
+#endif
+                        obj = next_obj(allocator, obj);
+                }
+        }
+
+        page_free_n(slab->s_addr, 1 << allocator->sa_order);
+        allocator->sa_nslabs--;
+        allocator->sa_reclaims++;
+        return 1 << allocator->sa_order;
+}
+
+/* The number of slabs on one of an allocator's lists. */
+static uint32_t
+_list_length(list_t *list)
+{
+        list_link_t *link;
+        uint32_t n = 0;
+
+        for (link = list->l_next; link != list; link = link->l_next)
+                n++;
+        return n;
+}
+
+/* Puts a slab on the list matching how many of its objects are used. */
+static void
+_slab_file(struct slab_allocator *allocator, struct slab *slab)
+{
+        list_t *list;
+
+        if (0 == slab->s_inuse)
+                list = &allocator->sa_empty;
+        else if (allocator->sa_slab_nobjs == slab->s_inuse)
+                list = &allocator->sa_full;
+        else
+                list = &allocator->sa_partial;
+        list_insert_head(list, &slab->s_link);
+}
+
 static int
 _slab_allocator_grow(struct slab_allocator *allocator)
 {
         void *addr;
+        void *first;
         void *obj;
         int ii, npages;
         struct slab *slab;
@@ -225,8 +390,14 @@ _slab_allocator_grow(struct slab_allocator *allocator)
         if (!addr)
                 return 0;
 
+        /* Objects start past the lead and this slab's color. */
+        first = (void *)((uintptr_t)addr + allocator->sa_lead + allocator->sa_color_next);
+        allocator->sa_color_next += allocator->sa_color_step;
+        if (allocator->sa_color_next > allocator->sa_color_max)
+                allocator->sa_color_next = 0;
+
         /* Initialize each bufctl to be free and point to the next object. */
-        obj = addr;
+        obj = first;
         for (ii = 0; ii < (allocator->sa_slab_nobjs - 1); ii++) {
 #ifdef SLAB_CHECK_FREE
                 obj_bufctl(allocator, obj)->sb_free = 1;
@@ -245,18 +416,24 @@ _slab_allocator_grow(struct slab_allocator *allocator)
 
         /*
          * The first object in the slab will be the head of the free
-         * list and the start address of the slab.
+         * list.
          */
-        slab->s_free = addr;
+        slab->s_free = first;
         slab->s_addr = addr;
+        slab->s_objs = first;
         slab->s_inuse = 0;
 
         /* Initialize objects. */
-        obj = addr;
+        obj = first;
         for (ii = 0; ii < allocator->sa_slab_nobjs; ii++) {
 #ifdef SLAB_REDZONE
                 front_rz(obj) = SLAB_REDZONE;
                 rear_rz(allocator, obj) = SLAB_REDZONE;
+                if (NULL != allocator->sa_ctor)
+                        allocator->sa_ctor((void *)((uintptr_t)obj + sizeof(SLAB_REDZONE)));
+#else
+                if (NULL != allocator->sa_ctor)
+                        allocator->sa_ctor(obj);
 #endif
                 obj = next_obj(allocator, obj);
         }
@@ -266,28 +443,29 @@ _slab_allocator_grow(struct slab_allocator *allocator)
             1 << allocator->sa_order);
 
         /* Place this slab into the cache. */
-        slab->s_next = allocator->sa_slabs;
-        allocator->sa_slabs = slab;
+        _slab_file(allocator, slab);
+        allocator->sa_nslabs++;
+        allocator->sa_grows++;
 
         return 1;
 }
 
-void *
-slab_obj_alloc(struct slab_allocator *allocator)
+static void *
+_slab_obj_alloc(struct slab_allocator *allocator)
 {
         struct slab *slab;
         void *obj;
 
-        /* Find a slab with a free object. */
-        for (;;) {
-                slab = allocator->sa_slabs;
-                while (slab && (slab->s_inuse == allocator->sa_slab_nobjs))
-                        slab = slab->s_next;
-                if (slab && (slab->s_inuse < allocator->sa_slab_nobjs))
-                        break;
-                if (!_slab_allocator_grow(allocator))
+        /* Find a slab with a free object, filling partially used slabs
+         * before starting on empty ones. */
+        if (!list_empty(&allocator->sa_partial)) {
+                slab = list_head(&allocator->sa_partial, struct slab, s_link);
+        } else {
+                if (list_empty(&allocator->sa_empty) && !_slab_allocator_grow(allocator))
                         return NULL;
+                slab = list_head(&allocator->sa_empty, struct slab, s_link);
         }
+        KASSERT(slab->s_inuse < allocator->sa_slab_nobjs);
 
         /*
          * Remove an object from the slab's free list.  We'll use the
@@ -302,6 +480,10 @@ slab_obj_alloc(struct slab_allocator *allocator)
 #endif
 
         slab->s_inuse++;
+        if (1 == slab->s_inuse || allocator->sa_slab_nobjs == slab->s_inuse) {
+                list_remove(&slab->s_link);
+                _slab_file(allocator, slab);
+        }
 
         dbg(DBG_MM, "Allocated object 0x%p from \"%s\" (0x%p), "
             "slab 0x%p, inuse %d\n", obj, allocator->sa_name,
@@ -316,15 +498,13 @@ slab_obj_alloc(struct slab_allocator *allocator)
         obj = (void *)((uintptr_t)obj + sizeof(SLAB_REDZONE));
 #endif
 
-        GDB_CALL_HOOK(slab_obj_alloc, obj, allocator);
         return obj;
 }
 
-void
-slab_obj_free(struct slab_allocator *allocator, void *obj)
+static void
+_slab_obj_free(struct slab_allocator *allocator, void *obj)
 {
         struct slab *slab;
-        GDB_CALL_HOOK(slab_obj_free, obj, allocator);
 
 #ifdef SLAB_REDZONE
         /* Move pointer back.  See the end of kmem_cache_alloc. */
@@ -344,12 +524,224 @@ slab_obj_free(struct slab_allocator *allocator, void *obj)
         obj_bufctl(allocator, obj)->sb_next = slab->s_free;
         slab->s_free = obj;
 
-        slab->s_inuse--;
+        if (0 == --slab->s_inuse || allocator->sa_slab_nobjs - 1 == slab->s_inuse) {
+                list_remove(&slab->s_link);
+                _slab_file(allocator, slab);
+        }
 
         dbg(DBG_MM, "Freed object 0x%p from \"%s\" (0x%p), slab 0x%p, inuse %d\n",
             obj, allocator->sa_name, allocator, slab, slab->s_inuse);
 }
 
+/* The object as the slab layer sees it, with its front red-zone. */
+#ifdef SLAB_REDZONE
+#define mag_raw_obj(obj)        ((void *)((uintptr_t)(obj) - sizeof(SLAB_REDZONE)))
+#else
+#define mag_raw_obj(obj)        (obj)
+#endif
+
+static void *
+_slab_mag_pop(struct slab_allocator *allocator)
+{
+        void *obj = allocator->sa_loaded->m_objs[--allocator->sa_loaded->m_rounds];
+
+#ifdef SLAB_REDZONE
+        VERIFY_REDZONES(allocator, mag_raw_obj(obj));
+#endif
+#ifdef SLAB_CHECK_FREE
+        obj_bufctl(allocator, mag_raw_obj(obj))->sb_free = 0;
+#endif
+        allocator->sa_mag_allocs++;
+        return obj;
+}
+
+static void
+_slab_mag_push(struct slab_allocator *allocator, void *obj)
+{
+#ifdef SLAB_REDZONE
+        VERIFY_REDZONES(allocator, mag_raw_obj(obj));
+#endif
+#ifdef SLAB_CHECK_FREE
+        KASSERT(!obj_bufctl(allocator, mag_raw_obj(obj))->sb_free && "INVALID FREE!");
+        obj_bufctl(allocator, mag_raw_obj(obj))->sb_free = 1;
+#endif
+        allocator->sa_loaded->m_objs[allocator->sa_loaded->m_rounds++] = obj;
+        allocator->sa_mag_frees++;
+}
+
+/* Exchanges the loaded and previous magazines. */
+static void
+_slab_mag_swap(struct slab_allocator *allocator)
+{
+        struct slab_magazine *mag = allocator->sa_loaded;
+        allocator->sa_loaded = allocator->sa_previous;
+        allocator->sa_previous = mag;
+}
+
+/*
+ * Takes an object from the magazines: from the loaded one, the previous
+ * one, or a full one from the depot which replaces the previous one.
+ * @return the object or NULL if all are empty
+ */
+static void *
+_slab_mag_alloc(struct slab_allocator *allocator)
+{
+        struct slab_magazine *mag;
+
+        if (NULL != allocator->sa_loaded && allocator->sa_loaded->m_rounds > 0)
+                return _slab_mag_pop(allocator);
+        if (NULL != allocator->sa_previous && allocator->sa_previous->m_rounds > 0) {
+                _slab_mag_swap(allocator);
+                return _slab_mag_pop(allocator);
+        }
+        if (NULL != (mag = allocator->sa_depot_full)) {
+                allocator->sa_depot_full = mag->m_next;
+                allocator->sa_ndepot_full--;
+                if (NULL != allocator->sa_previous) {
+                        allocator->sa_previous->m_next = allocator->sa_depot_empty;
+                        allocator->sa_depot_empty = allocator->sa_previous;
+                }
+                allocator->sa_previous = allocator->sa_loaded;
+                allocator->sa_loaded = mag;
+                return _slab_mag_pop(allocator);
+        }
+        return NULL;
+}
+
+/*
+ * Puts a freed object into the loaded magazine, the previous one, or an
+ * empty one from the depot (or a new one) after the previous one goes to
+ * the depot as full.
+ * @return 1 on success, 0 if the object must go back to its slab
+ */
+static int
+_slab_mag_free(struct slab_allocator *allocator, void *obj)
+{
+        struct slab_magazine *mag;
+
+        if (NULL != allocator->sa_loaded && allocator->sa_loaded->m_rounds < SLAB_MAG_ROUNDS) {
+                _slab_mag_push(allocator, obj);
+                return 1;
+        }
+        if (NULL != allocator->sa_previous && allocator->sa_previous->m_rounds < SLAB_MAG_ROUNDS) {
+                _slab_mag_swap(allocator);
+                _slab_mag_push(allocator, obj);
+                return 1;
+        }
+        if (allocator->sa_ndepot_full >= SLAB_DEPOT_MAX)
+                return 0;
+        if (NULL != (mag = allocator->sa_depot_empty)) {
+                allocator->sa_depot_empty = mag->m_next;
+        } else {
+                if (NULL == (mag = slab_obj_alloc(&slab_magazine_allocator)))
+                        return 0;
+                mag->m_rounds = 0;
+        }
+        if (NULL != allocator->sa_previous) {
+                allocator->sa_previous->m_next = allocator->sa_depot_full;
+                allocator->sa_depot_full = allocator->sa_previous;
+                allocator->sa_ndepot_full++;
+        }
+        allocator->sa_previous = allocator->sa_loaded;
+        allocator->sa_loaded = mag;
+        _slab_mag_push(allocator, obj);
+        return 1;
+}
+
+/* Returns the objects in a magazine to their slabs and frees it. */
+static void
+_slab_mag_destroy(struct slab_allocator *allocator, struct slab_magazine *mag)
+{
+        while (mag->m_rounds > 0) {
+                void *obj = mag->m_objs[--mag->m_rounds];
+#ifdef SLAB_CHECK_FREE
+                obj_bufctl(allocator, mag_raw_obj(obj))->sb_free = 0;
+#endif
+                _slab_obj_free(allocator, obj);
+                allocator->sa_flushed++;
+        }
+        slab_obj_free(&slab_magazine_allocator, mag);
+}
+
+/* Empties all of an allocator's magazines back into its slabs. */
+static void
+_slab_mag_flush(struct slab_allocator *allocator)
+{
+        struct slab_magazine *mag;
+
+        while (NULL != (mag = allocator->sa_depot_full)) {
+                allocator->sa_depot_full = mag->m_next;
+                _slab_mag_destroy(allocator, mag);
+        }
+        allocator->sa_ndepot_full = 0;
+        while (NULL != (mag = allocator->sa_depot_empty)) {
+                allocator->sa_depot_empty = mag->m_next;
+                _slab_mag_destroy(allocator, mag);
+        }
+        if (NULL != allocator->sa_loaded) {
+                _slab_mag_destroy(allocator, allocator->sa_loaded);
+                allocator->sa_loaded = NULL;
+        }
+        if (NULL != allocator->sa_previous) {
+                _slab_mag_destroy(allocator, allocator->sa_previous);
+                allocator->sa_previous = NULL;
+        }
+}
+
+void *
+slab_obj_alloc(struct slab_allocator *allocator)
+{
+        void *obj = NULL;
+
+        allocator->sa_allocs++;
+        if (allocator->sa_magazines)
+                obj = _slab_mag_alloc(allocator);
+        if (NULL == obj)
+                obj = _slab_obj_alloc(allocator);
+
+        GDB_CALL_HOOK(slab_obj_alloc, obj, allocator);
+        return obj;
+}
+
+void
+slab_obj_free(struct slab_allocator *allocator, void *obj)
+{
+        GDB_CALL_HOOK(slab_obj_free, obj, allocator);
+
+        allocator->sa_frees++;
+        if (allocator->sa_magazines && _slab_mag_free(allocator, obj))
+                return;
+        _slab_obj_free(allocator, obj);
+}
+
+size_t
+slab_info(const void *arg, char *buf, size_t osize)
+{
+        size_t size = osize;
+        struct slab_allocator *a;
+
+        /* Objects in use are those handed out and not freed, and the
+         * bytes wasted are what the pages held are not used for by them:
+         * free and magazine objects, red-zones, bufctls, padding, slab
+         * structures and leftover space. */
+        iprintf(&buf, &size, "%-15s %5s %6s %8s %8s %5s %5s %5s %7s %4s %6s\n",
+                "name", "size", "inuse", "allocs", "frees", "grows",
+                "recl", "pages", "waste", "mag%", "flush");
+        for (a = slab_allocators; NULL != a; a = a->sa_next) {
+                uint32_t ops = a->sa_allocs + a->sa_frees;
+                uint32_t inuse = a->sa_allocs - a->sa_frees;
+                uint32_t npages = a->sa_nslabs << a->sa_order;
+                iprintf(&buf, &size, "%-15s %5u %6u %8u %8u %5u %5u %5u %7u %3u%% %6u\n",
+                        a->sa_name, a->sa_size, inuse, a->sa_allocs, a->sa_frees,
+                        a->sa_grows, a->sa_reclaims, npages,
+                        npages * PAGE_SIZE - inuse * a->sa_size,
+                        0 == ops ? 0 : (a->sa_mag_allocs + a->sa_mag_frees) * 100 / ops,
+                        a->sa_flushed);
+        }
+
+        return size;
+}
+
 /*
  * Reclaims as much memory (up to a target) from
  * unused slabs as possible
@@ -360,92 +752,246 @@ slab_obj_free(struct slab_allocator *allocator, void *obj)
 int
 slab_allocators_reclaim(int target)
 {
-        int npages_freed = 0, npages;
+        int npages_freed = 0;
 
         struct slab_allocator *a;
-        struct slab *s, **prev;
+        struct slab *s;
 
-        /* Go through all caches */
+        /* Under memory pressure cached objects are not worth keeping:
+         * flush the magazines first, which may leave more slabs empty */
+        for (a = slab_allocators; NULL != a; a = a->sa_next)
+                _slab_mag_flush(a);
+
+        /* Go through all caches, freeing their empty slabs */
         for (a = slab_allocators; NULL != a; a = a->sa_next) {
-                prev = &(a->sa_slabs);
-                s = a->sa_slabs;
-                while (NULL != s) {
-                        struct slab *next = s->s_next;
-                        if (0 == s->s_inuse) {
-                                /* Free Slab */
-                                (*prev) = next;
-                                npages = 1 << a->sa_order;
-
-                                page_free_n(s->s_addr, npages);
-                                npages_freed += npages;
-                        } else {
-                                prev = &(s->s_next);
-                        }
+                while (!list_empty(&a->sa_empty)) {
+                        s = list_head(&a->sa_empty, struct slab, s_link);
+                        list_remove(&s->s_link);
+                        npages_freed += _slab_destroy(a, s);
+
                         /* Check if target was met */
                         if ((target > 0) && (npages_freed >= target)) {
                                 return npages_freed;
                         }
-                        s = next;
                 }
         }
         return npages_freed;
 }
 
-#define KMALLOC_SIZE_MIN_ORDER  (6)
-#define KMALLOC_SIZE_MAX_ORDER  (18)
+/*
+ * The slab shrinker. Besides the empty slabs, objects cached in
+ * magazines are counted at their size; flushing them frees slabs only
+ * when it leaves some empty, so this is an estimate.
+ */
+static uint32_t
+slab_shrinker_count(shrinker_t *sh)
+{
+        struct slab_allocator *a;
+        struct slab_magazine *mag;
+        uint32_t npages = 0, nbytes;
 
-static struct slab_allocator *kmalloc_allocators[KMALLOC_SIZE_MAX_ORDER - KMALLOC_SIZE_MIN_ORDER + 1];
+        for (a = slab_allocators; NULL != a; a = a->sa_next) {
+                nbytes = 0;
+                if (NULL != a->sa_loaded)
+                        nbytes += a->sa_loaded->m_rounds * a->sa_objsize;
+                if (NULL != a->sa_previous)
+                        nbytes += a->sa_previous->m_rounds * a->sa_objsize;
+                for (mag = a->sa_depot_full; NULL != mag; mag = mag->m_next)
+                        nbytes += mag->m_rounds * a->sa_objsize;
+                npages += (nbytes >> PAGE_SHIFT)
+                          + (_list_length(&a->sa_empty) << a->sa_order);
+        }
+        return npages;
+}
 
-/* Note that kmem_cache_names should be modified to remain consistent
- * with KMALLOC_SIZE_MIN_ORDER ... KMALLOC_SIZE_MAX_ORDER.
+static uint32_t
+slab_shrinker_scan(shrinker_t *sh, uint32_t npages)
+{
+        return slab_allocators_reclaim(npages);
+}
+
+static shrinker_t slab_shrinker = {
+        .sh_name = "slab",
+        .sh_count = slab_shrinker_count,
+        .sh_scan = slab_shrinker_scan
+};
+
+/*
+ * kmalloc size classes. Between the powers of two there is a class half
+ * way up, so no more than a third of an object is lost to rounding.
+ * Requests that do not fit in the largest class (with the header) are
+ * given whole pages.
+ */
+#define KMALLOC_NCLASSES        12
+#define KMALLOC_GRAIN_SHIFT     5
+#define KMALLOC_MAX_CLASS       2048
+
+static const size_t kmalloc_class_sizes[KMALLOC_NCLASSES] = {
+        32, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048
+};
+
+/* Note that kmalloc_allocator_names should be modified to remain
+ * consistent with kmalloc_class_sizes.
  */
-static const char *kmalloc_allocator_names[] = {
+static const char *kmalloc_allocator_names[KMALLOC_NCLASSES] = {
+        "size-32",
         "size-64",
+        "size-96",
         "size-128",
+        "size-192",
         "size-256",
+        "size-384",
         "size-512",
+        "size-768",
         "size-1024",
-        "size-2048",
-        "size-4096",
-        "size-8192",
-        "size-16384",
-        "size-32768",
-        "size-65536",
-        "size-131072",
-        "size-262144"
+        "size-1536",
+        "size-2048"
 };
 
+static struct slab_allocator *kmalloc_allocators[KMALLOC_NCLASSES];
+
+/* The class of a size, by 32 byte grain (see kmalloc_class()). */
+static uint8_t kmalloc_class_table[KMALLOC_MAX_CLASS >> KMALLOC_GRAIN_SHIFT];
+#define kmalloc_class(size) \
+        (kmalloc_class_table[((size) - 1) >> KMALLOC_GRAIN_SHIFT])
+
+/*
+ * Internal fragmentation of each class: bytes of the objects not asked
+ * for (including the header) and the number of allocations. Both are
+ * halved when the count gets large, keeping the average recent.
+ */
+#define KMALLOC_STATS_DECAY     (1 << 20)
+
+static struct {
+        uint32_t        ks_allocs;
+        uint32_t        ks_waste;
+} kmalloc_stats[KMALLOC_NCLASSES];
+
+/*
+ * Large allocations are recorded by the size asked for, in a table of
+ * one entry per page, allocated 4MB of address space at a time. Since
+ * only those entries are ever nonzero kfree() can tell a large
+ * allocation from a page aligned slab object.
+ */
+#define KMALLOC_LARGE_SHIFT     22
+#define KMALLOC_LARGE_MAX       (PAGE_SIZE << (PAGE_NSIZES - 1))
+
+static size_t *kmalloc_large_table[1 << (32 - KMALLOC_LARGE_SHIFT)];
+#define kmalloc_large_entry(addr) \
+        (kmalloc_large_table[(uintptr_t)(addr) >> KMALLOC_LARGE_SHIFT] \
+         + ((((uintptr_t)(addr)) & ((1 << KMALLOC_LARGE_SHIFT) - 1)) >> PAGE_SHIFT))
+
+static uint32_t kmalloc_nlarge;        /* large allocations in use */
+static uint32_t kmalloc_large_pages;   /* pages they take */
+static uint32_t kmalloc_large_bytes;   /* bytes they were asked for */
+
+static size_t
+_kmalloc_large_size(void *addr)
+{
+        if (!PAGE_ALIGNED(addr)
+            || NULL == kmalloc_large_table[(uintptr_t)addr >> KMALLOC_LARGE_SHIFT])
+                return 0;
+        return *kmalloc_large_entry(addr);
+}
+
+static void *
+_kmalloc_large(size_t size)
+{
+        size_t **table;
+        uint32_t npages;
+        void *addr;
+
+        if (size > KMALLOC_LARGE_MAX)
+                panic("size bigger than maximum %lu\n", (unsigned long) size);
+
+        npages = (size + PAGE_SIZE - 1) >> PAGE_SHIFT;
+        if (NULL == (addr = page_alloc_n(npages))) {
+                dbg(DBG_MM, "WARNING: kmalloc out of memory\n");
+                return NULL;
+        }
+
+        table = &kmalloc_large_table[(uintptr_t)addr >> KMALLOC_LARGE_SHIFT];
+        if (NULL == *table) {
+                if (NULL == (*table = page_alloc())) {
+                        dbg(DBG_MM, "WARNING: kmalloc out of memory\n");
+                        page_free_n(addr, npages);
+                        return NULL;
+                }
+                memset(*table, 0, PAGE_SIZE);
+        }
+        *kmalloc_large_entry(addr) = size;
+
+        kmalloc_nlarge++;
+        kmalloc_large_pages += npages;
+        kmalloc_large_bytes += size;
+#ifdef MM_POISON
+        memset(addr, MM_POISON_ALLOC, size);
+#endif /* MM_POISON */
+        return addr;
+}
+
+static void
+_kfree_large(void *addr, size_t size)
+{
+        uint32_t npages = (size + PAGE_SIZE - 1) >> PAGE_SHIFT;
+
+        *kmalloc_large_entry(addr) = 0;
+        kmalloc_nlarge--;
+        kmalloc_large_pages -= npages;
+        kmalloc_large_bytes -= size;
+#ifdef MM_POISON
+        memset(addr, MM_POISON_FREE, size);
+#endif /* MM_POISON */
+        page_free_n(addr, npages);
+}
+
 void *
 kmalloc(size_t size)
 {
-        int order;
-        struct slab_allocator **cs;
+        int class;
         void *addr;
 
-        size += sizeof(struct slab_allocator *);
+        if (size + sizeof(struct slab_allocator *) > KMALLOC_MAX_CLASS)
+                return _kmalloc_large(size);
+
+        class = kmalloc_class(size + sizeof(struct slab_allocator *));
+        addr = slab_obj_alloc(kmalloc_allocators[class]);
+        if (!addr) {
+                dbg(DBG_MM, "WARNING: kmalloc out of memory\n");
+                return NULL;
+        }
+
+        if (KMALLOC_STATS_DECAY == ++kmalloc_stats[class].ks_allocs) {
+                kmalloc_stats[class].ks_allocs >>= 1;
+                kmalloc_stats[class].ks_waste >>= 1;
+        }
+        kmalloc_stats[class].ks_waste += kmalloc_class_sizes[class] - size;
 
-        /*
-         * Find the first power of two bucket bigger than the
-         * requested size, and allocate from it.
-         */
-        cs = kmalloc_allocators;
-        for (order = KMALLOC_SIZE_MIN_ORDER; order <= KMALLOC_SIZE_MAX_ORDER; order++, cs++) {
-                if ((size_t)(1 << order) >= size) {
-                        addr = slab_obj_alloc(*cs);
-                        if (!addr) {
-                                dbg(DBG_MM, "WARNING: kmalloc out of memory\n");
-                                return NULL;
-                        }
 #ifdef MM_POISON
-                        memset(addr, MM_POISON_ALLOC, size);
+        memset(addr, MM_POISON_ALLOC, size + sizeof(struct slab_allocator *));
 #endif /* MM_POISON */
-                        *((struct slab_allocator **)addr) = *cs;
-                        return (void *)(((struct slab_allocator **)addr) + 1);
-                }
+        *((struct slab_allocator **)addr) = kmalloc_allocators[class];
+        return (void *)(((struct slab_allocator **)addr) + 1);
+}
+
+size_t
+kmalloc_info(const void *arg, char *buf, size_t osize)
+{
+        size_t size = osize;
+        int class;
+
+        iprintf(&buf, &size, "%-10s %9s %9s %6s\n", "class", "allocs", "avg waste", "waste");
+        for (class = 0; class < KMALLOC_NCLASSES; class++) {
+                uint32_t n = kmalloc_stats[class].ks_allocs;
+                uint32_t avg = (0 == n) ? 0 : kmalloc_stats[class].ks_waste / n;
+                iprintf(&buf, &size, "%-10s %9u %9u %5u%%\n", kmalloc_allocator_names[class],
+                        n, avg, avg * 100 / kmalloc_class_sizes[class]);
         }
+        iprintf(&buf, &size, "large: %u allocations, %u pages, %u bytes unused\n",
+                kmalloc_nlarge, kmalloc_large_pages,
+                kmalloc_large_pages * PAGE_SIZE - kmalloc_large_bytes);
 
-        panic("size bigger than maxorder %ld\n", (unsigned long) size);
-        return NULL;
+        return size;
 }
 
 __attribute__((used)) static void *
@@ -460,6 +1006,13 @@ malloc(size_t size)
 void
 kfree(void *addr)
 {
+        size_t large;
+
+        if (0 != (large = _kmalloc_large_size(addr))) {
+                _kfree_large(addr, large);
+                return;
+        }
+
         addr = (void *)(((struct slab_allocator **)addr) - 1);
         struct slab_allocator *sa = *(struct slab_allocator **)addr;
 
@@ -489,20 +1042,85 @@ free(void *addr)
 void
 slab_init()
 {
-        int order;
-        struct slab_allocator **cs;
+        int class;
+        size_t grain;
 
         /* Special case initialization of the kmem_cache_t cache. */
-        _allocator_init(&slab_allocator_allocator, "slab_allocators", sizeof(struct slab_allocator));
+        _allocator_init(&slab_allocator_allocator, "slab_allocators", sizeof(struct slab_allocator), 0);
+        _allocator_init(&slab_magazine_allocator, "slab_magazines", sizeof(struct slab_magazine), 0);
+        shrinker_register(&slab_shrinker);
 
         /*
-         * Allocate the power of two buckets for generic
-         * kmalloc/kfree.
+         * Allocate the size classes for generic kmalloc/kfree, and
+         * map each grain of size to the smallest class that holds it.
          */
-        cs = kmalloc_allocators;
-        for (order = KMALLOC_SIZE_MIN_ORDER; order <= KMALLOC_SIZE_MAX_ORDER; order++, cs++) {
-                if (NULL == (*cs = slab_allocator_create(kmalloc_allocator_names[order - KMALLOC_SIZE_MIN_ORDER], (1 << order)))) {
+        class = 0;
+        for (grain = 0; grain < (KMALLOC_MAX_CLASS >> KMALLOC_GRAIN_SHIFT); grain++) {
+                if (((grain + 1) << KMALLOC_GRAIN_SHIFT) > kmalloc_class_sizes[class])
+                        class++;
+                kmalloc_class_table[grain] = class;
+        }
+
+        for (class = 0; class < KMALLOC_NCLASSES; class++) {
+                if (NULL == (kmalloc_allocators[class] =
+                                     slab_allocator_create(kmalloc_allocator_names[class],
+                                                           kmalloc_class_sizes[class], 0, NULL, NULL))) {
                         panic("Couldn't create kmalloc allocators!\n");
                 }
         }
 }
+
+/*
+ * /dev/slabinfo: reading it gives the output of slab_info() followed by
+ * that of kmalloc_info(), as they are at the time of each read.
+ */
+static int
+slabinfo_read(bytedev_t *dev, int offset, void *buf, int count)
+{
+        char *info;
+        size_t len;
+
+        if (NULL == (info = page_alloc()))
+                return -ENOMEM;
+        slab_info(NULL, info, PAGE_SIZE);
+        len = strlen(info);
+        kmalloc_info(NULL, info + len, PAGE_SIZE - len);
+        len += strlen(info + len);
+
+        if ((size_t)offset >= len)
+                count = 0;
+        else if ((size_t)(offset + count) > len)
+                count = len - offset;
+        memcpy(buf, info + offset, count);
+
+        page_free(info);
+        return count;
+}
+
+/* There is nothing to write to. */
+static int
+slabinfo_write(bytedev_t *dev, int offset, const void *buf, int count)
+{
+        return -EINVAL;
+}
+
+static bytedev_ops_t slabinfo_dev_ops = {
+        slabinfo_read,
+        slabinfo_write,
+        NULL,
+        NULL,
+        NULL,
+        NULL
+};
+
+static bytedev_t slabinfo_dev;
+
+static __attribute__((unused)) void
+slabinfo_init(void)
+{
+        slabinfo_dev.cd_id = MEM_SLABINFO_DEVID;
+        slabinfo_dev.cd_ops = &slabinfo_dev_ops;
+        if (0 > bytedev_register(&slabinfo_dev))
+                panic("Couldn't register /dev/slabinfo!\n");
+}
+init_func(slabinfo_init);
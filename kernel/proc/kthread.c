@@ -27,10 +27,43 @@
 
 #include "mm/slab.h"
 #include "mm/page.h"
+#include "mm/shrinker.h"
 
 kthread_t *curthr; /* global */
 static slab_allocator_t *kthread_allocator = NULL;
 
+/* extra page for "magic" data */
+#define KSTACK_NPAGES           (1 + (DEFAULT_STACK_SIZE >> PAGE_SHIFT))
+
+/* Stacks of destroyed threads kept for new ones, given back to the page
+ * allocator by the shrinker below when memory runs short. */
+static char *kstack_cache[KTHREAD_STACK_CACHE];
+static int kstack_ncached;
+
+static uint32_t
+kstack_shrinker_count(shrinker_t *sh)
+{
+        return kstack_ncached * KSTACK_NPAGES;
+}
+
+static uint32_t
+kstack_shrinker_scan(shrinker_t *sh, uint32_t npages)
+{
+        uint32_t nfreed = 0;
+
+        while (nfreed < npages && kstack_ncached > 0) {
+                page_free_n(kstack_cache[--kstack_ncached], KSTACK_NPAGES);
+                nfreed += KSTACK_NPAGES;
+        }
+        return nfreed;
+}
+
+static shrinker_t kstack_shrinker = {
+        .sh_name = "kstack",
+        .sh_count = kstack_shrinker_count,
+        .sh_scan = kstack_shrinker_scan
+};
+
 #ifdef __MTP__
 /* Stuff for the reaper daemon, which cleans up dead detached threads */
 static proc_t *reapd = NULL;
@@ -44,8 +77,10 @@ static void *kthread_reapd_run(int arg1, void *arg2);
 void
 kthread_init()
 {
-        kthread_allocator = slab_allocator_create("kthread", sizeof(kthread_t));
+        kthread_allocator = slab_allocator_create("kthread", sizeof(kthread_t),
+                                                  SLAB_CACHE_LINE, NULL, NULL);
         KASSERT(NULL != kthread_allocator);
+        shrinker_register(&kstack_shrinker);
 }
 
 /**
@@ -57,10 +92,11 @@ kthread_init()
 static char *
 alloc_stack(void)
 {
-        /* extra page for "magic" data */
         char *kstack;
-        int npages = 1 + (DEFAULT_STACK_SIZE >> PAGE_SHIFT);
-        kstack = (char *)page_alloc_n(npages);
+
+        if (kstack_ncached > 0)
+                return kstack_cache[--kstack_ncached];
+        kstack = (char *)page_alloc_n(KSTACK_NPAGES);
 
         return kstack;
 }
@@ -73,7 +109,10 @@ alloc_stack(void)
 static void
 free_stack(char *stack)
 {
-        page_free_n(stack, 1 + (DEFAULT_STACK_SIZE >> PAGE_SHIFT));
+        if (kstack_ncached < KTHREAD_STACK_CACHE)
+                kstack_cache[kstack_ncached++] = stack;
+        else
+                page_free_n(stack, KSTACK_NPAGES);
 }
 
 void
@@ -113,6 +152,11 @@ kthread_create(struct proc *p, kthread_func_t func, long arg1, void *arg2)
 	new_thr->kt_errno = NULL;
 	new_thr->kt_cancelled = 0;
 	new_thr->kt_state  = KT_RUN; /* make it runnable */
+	new_thr->kt_timeslice = SCHED_TIMESLICE;
+	new_thr->kt_runticks = 0;
+	new_thr->kt_static_prio = PRIO_DEFAULT;
+	new_thr->kt_prio = PRIO_DEFAULT;
+	new_thr->kt_exclusive = 0;
 	/*initialize pointer to kt_wchan to NULL:*/
 	new_thr->kt_wchan = NULL;
 	/* setup context, very gross looking */
@@ -20,6 +20,7 @@
 #include "util/list.h"
 #include "util/string.h"
 #include "util/printf.h"
+#include "util/time.h"
 
 #include "proc/kthread.h"
 #include "proc/proc.h"
@@ -49,7 +50,7 @@ void
 proc_init()
 {
         list_init(&_proc_list);
-        proc_allocator = slab_allocator_create("proc", sizeof(proc_t));
+        proc_allocator = slab_allocator_create("proc", sizeof(proc_t), 0, NULL, NULL);
         KASSERT(proc_allocator != NULL);
 }
 
@@ -599,6 +600,13 @@ proc_info(const void *arg, char *buf, size_t osize)
         iprintf(&buf, &size, "status:       %i\n", p->p_status);
         iprintf(&buf, &size, "state:        %i\n", p->p_state);
 
+        uint32_t runticks = 0;
+        kthread_t *thr;
+        list_iterate_begin(&p->p_threads, thr, kthread_t, kt_plink) {
+                runticks += thr->kt_runticks;
+        } list_iterate_end();
+        iprintf(&buf, &size, "run time:     %u ms\n", jiffies_to_msecs(runticks));
+
 #ifdef __VFS__
 #ifdef __GETCWD__
         if (NULL != p->p_cwd) {
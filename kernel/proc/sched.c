@@ -19,15 +19,27 @@
 #include "proc/sched.h"
 #include "proc/kthread.h"
 
+#include "mm/page.h"
+
 #include "util/init.h"
+#include "util/time.h"
+#include "util/timer.h"
 #include "util/debug.h"
 
-static ktqueue_t kt_runq;
+/* One run queue per priority level, and a bit set for every non-empty one */
+static ktqueue_t kt_runq[SCHED_NPRIO];
+static uint32_t kt_runq_bitmap = 0;
+
+/* Set by sched_tick when the current thread's time slice runs out */
+static int sched_need_resched = 0;
 
 static __attribute__((unused)) void
 sched_init(void)
 {
-        sched_queue_init(&kt_runq);
+        int i;
+
+        for (i = 0; i < SCHED_NPRIO; i++)
+                sched_queue_init(&kt_runq[i]);
 }
 init_func(sched_init);
 
@@ -89,6 +101,50 @@ ktqueue_remove(ktqueue_t *q, kthread_t *thr)
         q->tq_size--;
 }
 
+/*** PRIVATE RUN QUEUE MANIPULATION FUNCTIONS ***/
+/* These must be called with the IPL raised to high. */
+
+static int
+runq_contains(ktqueue_t *q)
+{
+        return q >= &kt_runq[0] && q < &kt_runq[SCHED_NPRIO];
+}
+
+/**
+ * Returns true if a thread at least as urgent as the given priority is
+ * waiting to run.
+ */
+static int
+runq_has(int prio)
+{
+        return 0 != (kt_runq_bitmap & ((1 << (prio + 1)) - 1));
+}
+
+static void
+runq_enqueue(kthread_t *thr)
+{
+        KASSERT(PRIO_HIGHEST <= thr->kt_prio && thr->kt_prio <= PRIO_LOWEST);
+        ktqueue_enqueue(&kt_runq[thr->kt_prio], thr);
+        kt_runq_bitmap |= 1 << thr->kt_prio;
+}
+
+/**
+ * Takes the longest waiting thread off the most urgent non-empty level.
+ */
+static kthread_t *
+runq_dequeue(void)
+{
+        kthread_t *thr;
+        int prio;
+
+        KASSERT(0 != kt_runq_bitmap);
+        prio = __builtin_ffs(kt_runq_bitmap) - 1;
+        thr = ktqueue_dequeue(&kt_runq[prio]);
+        if (sched_queue_empty(&kt_runq[prio]))
+                kt_runq_bitmap &= ~(1 << prio);
+        return thr;
+}
+
 /*** PUBLIC KTQUEUE MANIPULATION FUNCTIONS ***/
 void
 sched_queue_init(ktqueue_t *q)
@@ -122,6 +178,14 @@ sched_sleep_on(ktqueue_t *q)
 }
 
 
+void
+sched_sleep_on_exclusive(ktqueue_t *q)
+{
+	curthr->kt_exclusive = 1;
+	sched_sleep_on(q);
+	curthr->kt_exclusive = 0;
+}
+
 /*
  * Similar to sleep on, but the sleep can be cancelled.
  *
@@ -154,6 +218,63 @@ sched_cancellable_sleep_on(ktqueue_t *q)
 	}
 }
 
+/*
+ * Wakes a thread whose timed sleep has run out. Runs from the clock
+ * interrupt with the IPL already high, so the thread cannot have been
+ * woken and put to sleep elsewhere in between.
+ */
+static void
+sched_timeout(void *data)
+{
+	kthread_t *thr = (kthread_t *)data;
+
+	if (KT_SLEEP != thr->kt_state && KT_SLEEP_CANCELLABLE != thr->kt_state)
+		return;
+	ktqueue_remove(thr->kt_wchan, thr);
+	sched_make_runnable(thr);
+}
+
+/*
+ * Sleeps on q in the given state until woken or until ticks have
+ * passed, and returns the number of ticks left.
+ */
+static uint32_t
+sched_sleep_timed(ktqueue_t *q, uint32_t ticks, int state)
+{
+	timer_t timer;
+	uint32_t expires = jiffies + ticks;
+	uint8_t old_ipl = intr_getipl();
+
+	/* keep the clock out until we are on q, or the timer could go
+	 * off while we are still running */
+	intr_setipl(IPL_HIGH);
+	timer_init(&timer, sched_timeout, curthr);
+	timer_add(&timer, expires);
+	curthr->kt_state = state;
+	ktqueue_enqueue(q, curthr);
+	sched_switch();
+	/* the timer lives on our stack, it must be gone before we return */
+	timer_del(&timer);
+	intr_setipl(old_ipl);
+
+	return ((int32_t)(expires - jiffies) > 0) ? expires - jiffies : 0;
+}
+
+uint32_t
+sched_sleep_on_timeout(ktqueue_t *q, uint32_t ticks)
+{
+	return sched_sleep_timed(q, ticks, KT_SLEEP);
+}
+
+int
+sched_cancellable_sleep_on_timeout(ktqueue_t *q, uint32_t *ticks)
+{
+	if (curthr->kt_cancelled)
+		return -EINTR;
+	*ticks = sched_sleep_timed(q, *ticks, KT_SLEEP_CANCELLABLE);
+	return curthr->kt_cancelled ? -EINTR : 0;
+}
+
 kthread_t *
 sched_wakeup_on(ktqueue_t *q)
 {
@@ -179,6 +300,28 @@ sched_wakeup_on(ktqueue_t *q)
 	return newthr;
 }
 
+int
+sched_wakeup_n(ktqueue_t *q, int n)
+{
+	kthread_t *thr;
+	int nwoken = 0;
+
+	KASSERT(q);
+	/* the oldest waiters are at the tail */
+	list_iterate_reverse(&q->tq_list, thr, kthread_t, kt_qlink) {
+		if (thr->kt_exclusive) {
+			if (n <= 0)
+				continue;
+			n--;
+		}
+		KASSERT((thr->kt_state == KT_SLEEP) || (thr->kt_state == KT_SLEEP_CANCELLABLE));
+		ktqueue_remove(q, thr);
+		sched_make_runnable(thr);
+		nwoken++;
+	} list_iterate_end();
+	return nwoken;
+}
+
 void
 sched_broadcast_on(ktqueue_t *q)
 {
@@ -192,7 +335,6 @@ sched_broadcast_on(ktqueue_t *q)
 	};
 	while(!sched_queue_empty(q)) { dbg(DBG_PRINT, "(GRADING1C 3)\n");
 		newthr = ktqueue_dequeue(q);
-		newthr->kt_state = KT_RUN;
 		/* remove thread from wait queue*/
 		/*ktqueue_remove(q, newthr); */
 		/* add that thread to run queue*/
@@ -282,7 +424,15 @@ sched_switch(void)
 	uint8_t old_ipl = intr_getipl(); /*get and save current interrupt level*/
 	intr_setipl(IPL_HIGH);
 
-	while(sched_queue_empty(&kt_runq)) {
+	while(0 == kt_runq_bitmap) {
+		/* nothing to run: zero a free page for page_alloc_zeroed,
+		 * letting interrupts in so a thread woken meanwhile is seen */
+		intr_setipl(IPL_LOW);
+		int zeroed = page_zero_idle();
+		intr_setipl(IPL_HIGH);
+		if(zeroed) {
+			continue;
+		}
 		dbg(DBG_PRINT, "INFO : waiting for interrupt. no threads in runQ\n");
 		dbg(DBG_PRINT, "(GRADING1A)\n");
 		intr_disable();
@@ -294,8 +444,11 @@ sched_switch(void)
 	/*save current thread to the old_thread: */
 	old_thread = curthr;
 	/* dequeue a thread from run queue:*/
-	curthr = ktqueue_dequeue(&kt_runq);
+	curthr = runq_dequeue();
 	curthr->kt_state = KT_RUN;
+	/* it starts a new time slice: */
+	curthr->kt_timeslice = SCHED_TIMESLICE;
+	sched_need_resched = 0;
 	/*set current process to be current thread's process:*/
 	curproc = curthr->kt_proc;
 	/*switch contexts:*/
@@ -324,17 +477,67 @@ void
 sched_make_runnable(kthread_t *thr)
 {
 	dbg(DBG_PRINT, "INFO : executing sched_make_runnable\n");
-	KASSERT(&kt_runq != thr->kt_wchan); /* make sure thread is not already in the runq */
+	KASSERT(!runq_contains(thr->kt_wchan)); /* make sure thread is not already in the runq */
 	dbg(DBG_PRINT, "(GRADING1A 4.b)\n");
     /*NOT_YET_IMPLEMENTED("PROCS: sched_make_runnable");*/
 
 	/*save old interrupt level and set curr interrupt level to high, blocking interrupts:*/
 	uint8_t old_ipl = intr_getipl(); /*get and save current interrupt level*/
 	intr_setipl(IPL_HIGH);
+	/* a thread woken from sleep gets a boost until it uses up a slice,
+	 * so threads waiting on I/O are not stuck behind busy ones: */
+	if(KT_SLEEP == thr->kt_state || KT_SLEEP_CANCELLABLE == thr->kt_state) {
+		thr->kt_prio = MAX(thr->kt_static_prio - SCHED_WAKE_BOOST, PRIO_HIGHEST);
+	}
 	/* set the thread state to runnable:*/
 	thr->kt_state = KT_RUN;
-	/* enqueue the thread to the kt_runq (runnable queue):*/
-	ktqueue_enqueue(&kt_runq, thr);
+	/* enqueue the thread on the run queue of its priority:*/
+	runq_enqueue(thr);
+	/* ask for the CPU back if the thread is more urgent than us: */
+	if(NULL != curthr && thr != curthr && thr->kt_prio < curthr->kt_prio) {
+		sched_need_resched = 1;
+	}
 	/*set the IPL to old:*/
 	intr_setipl(old_ipl);
 }
+
+void
+sched_tick(void)
+{
+	/* in the idle loop of sched_switch curthr is the thread which
+	 * blocked, it is not using the CPU */
+	if (NULL == curthr || KT_RUN != curthr->kt_state)
+		return;
+	curthr->kt_runticks++;
+	if (curthr->kt_timeslice > 0 && 0 == --curthr->kt_timeslice) {
+		/* a full slice used, any wakeup boost is over */
+		curthr->kt_prio = curthr->kt_static_prio;
+		sched_need_resched = 1;
+	}
+}
+
+void
+sched_preempt(void)
+{
+	if (!sched_need_resched)
+		return;
+	sched_need_resched = 0;
+	/* nobody at least as urgent wants the CPU, keep it for another slice */
+	if (!runq_has(curthr->kt_prio)) {
+		if (0 == curthr->kt_timeslice)
+			curthr->kt_timeslice = SCHED_TIMESLICE;
+		return;
+	}
+	dbg(DBG_SCHED, "preempting thread 0x%p (%d)\n", curthr, curproc->p_pid);
+	sched_make_runnable(curthr);
+	sched_switch();
+}
+
+void
+sched_set_priority(kthread_t *thr, int prio)
+{
+	KASSERT(PRIO_HIGHEST <= prio && prio <= PRIO_LOWEST);
+	KASSERT(!runq_contains(thr->kt_wchan));
+	thr->kt_static_prio = prio;
+	thr->kt_prio = prio;
+}
@@ -0,0 +1,73 @@
+/******************************************************************************/
+/* Important Spring 2015 CSCI 402 usage information:                          */
+/*                                                                            */
+/* This fils is part of CSCI 402 kernel programming assignments at USC.       */
+/* Please understand that you are NOT permitted to distribute or publically   */
+/*         display a copy of this file (or ANY PART of it) for any reason.    */
+/* If anyone (including your prospective employer) asks you to post the code, */
+/*         you must inform them that you do NOT have permissions to do so.    */
+/* You are also NOT permitted to remove or alter this comment block.          */
+/* If this comment block is removed or altered in a submitted file, 20 points */
+/*         will be deducted.                                                  */
+/******************************************************************************/
+
+#include "globals.h"
+
+#include "main/interrupt.h"
+#include "main/smp.h"
+
+#include "proc/spinlock.h"
+
+#include "util/debug.h"
+
+/* Atomically stores val at addr and returns what was there. */
+static inline uint32_t
+spinlock_xchg(volatile uint32_t *addr, uint32_t val)
+{
+        __asm__ volatile("xchgl %0, %1"
+                         : "+r"(val), "+m"(*addr)
+                         :
+                         : "memory");
+        return val;
+}
+
+void
+spinlock_init(spinlock_t *lock)
+{
+        lock->sl_locked = 0;
+        lock->sl_cpu = -1;
+        lock->sl_ipl = 0;
+}
+
+void
+spinlock_lock(spinlock_t *lock)
+{
+        uint8_t ipl = intr_getipl();
+
+        intr_setipl(IPL_HIGH);
+        KASSERT(!spinlock_held(lock) && "spinlocks are not re-entrant");
+        while (0 != spinlock_xchg(&lock->sl_locked, 1)) {
+                /* wait for a release without hammering the bus */
+                while (lock->sl_locked)
+                        __asm__ volatile("pause");
+        }
+        lock->sl_cpu = smp_self()->cpu_id;
+        lock->sl_ipl = ipl;
+}
+
+void
+spinlock_unlock(spinlock_t *lock)
+{
+        uint8_t ipl = lock->sl_ipl;
+
+        KASSERT(spinlock_held(lock));
+        lock->sl_cpu = -1;
+        spinlock_xchg(&lock->sl_locked, 0);
+        intr_setipl(ipl);
+}
+
+int
+spinlock_held(spinlock_t *lock)
+{
+        return lock->sl_locked && smp_self()->cpu_id == lock->sl_cpu;
+}
@@ -24,6 +24,12 @@
 #include "fs/vnode.h"
 #endif
 
+#include "mm/kmalloc.h"
+#include "mm/page.h"
+#include "mm/pframe.h"
+#include "mm/shrinker.h"
+#include "mm/slab.h"
+
 #include "test/kshell/io.h"
 
 #include "util/debug.h"
@@ -73,6 +79,60 @@ int kshell_echo(kshell_t *ksh, int argc, char **argv)
         return 0;
 }
 
+int kshell_pframes(kshell_t *ksh, int argc, char **argv)
+{
+        char buf[KSH_BUF_SIZE];
+
+        pframe_info(NULL, buf, sizeof(buf));
+        kprintf(ksh, "%s", buf);
+
+        return 0;
+}
+
+int kshell_pages(kshell_t *ksh, int argc, char **argv)
+{
+        char buf[KSH_BUF_SIZE];
+
+        page_info(NULL, buf, sizeof(buf));
+        kprintf(ksh, "%s", buf);
+
+        return 0;
+}
+
+int kshell_slabs(kshell_t *ksh, int argc, char **argv)
+{
+        /* A line per allocator does not fit in KSH_BUF_SIZE */
+        char *buf;
+
+        if (NULL == (buf = page_alloc()))
+                return -ENOMEM;
+        slab_info(NULL, buf, PAGE_SIZE);
+        kprintf(ksh, "%s", buf);
+        page_free(buf);
+
+        return 0;
+}
+
+int kshell_kmalloc(kshell_t *ksh, int argc, char **argv)
+{
+        char buf[KSH_BUF_SIZE];
+
+        kmalloc_info(NULL, buf, sizeof(buf));
+        kprintf(ksh, "%s", buf);
+
+        return 0;
+}
+
+int kshell_shrinkers(kshell_t *ksh, int argc, char **argv)
+{
+        char buf[KSH_BUF_SIZE];
+
+        shrinker_info(NULL, buf, sizeof(buf));
+        kprintf(ksh, "%s", buf);
+
+        return 0;
+}
+
 #ifdef __VFS__
 int kshell_cat(kshell_t *ksh, int argc, char **argv)
 {
@@ -21,6 +21,11 @@
 KSHELL_CMD(help);
 KSHELL_CMD(exit);
 KSHELL_CMD(echo);
+KSHELL_CMD(pframes);
+KSHELL_CMD(pages);
+KSHELL_CMD(slabs);
+KSHELL_CMD(kmalloc);
+KSHELL_CMD(shrinkers);
 #ifdef __VFS__
 KSHELL_CMD(cat);
 KSHELL_CMD(ls);
@@ -47,6 +47,16 @@ static __attribute__((unused)) void kshell_init()
         kshell_add_command("help", kshell_help,
                            "prints a list of available commands");
         kshell_add_command("echo", kshell_echo, "display a line of text");
+        kshell_add_command("pframes", kshell_pframes,
+                           "display page frame cache statistics");
+        kshell_add_command("pages", kshell_pages,
+                           "display page allocator statistics");
+        kshell_add_command("slabs", kshell_slabs,
+                           "display slab allocator statistics");
+        kshell_add_command("kmalloc", kshell_kmalloc,
+                           "display kmalloc size class statistics");
+        kshell_add_command("shrinkers", kshell_shrinkers,
+                           "display cache shrinker statistics");
 #ifdef __VFS__
         kshell_add_command("cat", kshell_cat,
                            "concatenate files and print on the standard output");
@@ -19,31 +19,29 @@
 
 #include "util/debug.h"
 #include "util/init.h"
+#include "util/time.h"
+#include "util/timer.h"
 
 #include "proc/sched.h"
 #include "proc/kthread.h"
 
 #define APIC_TIMER_IRQ 32 /* Map interrupt 32 */
 
-#ifdef __UPREEMPT__
-static unsigned int ms = 0;
+volatile uint32_t jiffies = 0;
 
-static void pit_handler(regs_t *regs)
+static void time_tick(regs_t *regs)
 {
-  dbg(DBG_CORE, "PIT HANDLER FIRED\n");
+  jiffies++;
+  timer_run();
+  sched_tick();
 }
 
-/* Uncomment this to enable the apic timer to 
- * call the pit_handler for userland preemption
- */
-
+/* The local APIC timer, calibrated against the PIT, drives the clock. */
 static __attribute__((unused)) void time_init(void)
 {
   intr_map(APIC_TIMER_IRQ, APIC_TIMER_IRQ);
-  intr_register(APIC_TIMER_IRQ, pit_handler);
-  /* TODO: figure out how this argument converts to hertz */
-  apic_enable_periodic_timer(8);
+  intr_register(APIC_TIMER_IRQ, time_tick);
+  apic_enable_periodic_timer(TICKS_PER_SEC);
 }
 init_func(time_init);
-
-#endif
+init_depends(timers_init);
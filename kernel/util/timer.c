@@ -0,0 +1,179 @@
+/******************************************************************************/
+/* Important Spring 2015 CSCI 402 usage information:                          */
+/*                                                                            */
+/* This fils is part of CSCI 402 kernel programming assignments at USC.       */
+/* Please understand that you are NOT permitted to distribute or publically   */
+/*         display a copy of this file (or ANY PART of it) for any reason.    */
+/* If anyone (including your prospective employer) asks you to post the code, */
+/*         you must inform them that you do NOT have permissions to do so.    */
+/* You are also NOT permitted to remove or alter this comment block.          */
+/* If this comment block is removed or altered in a submitted file, 20 points */
+/*         will be deducted.                                                  */
+/******************************************************************************/
+
+#include "globals.h"
+#include "kernel.h"
+
+#include "main/interrupt.h"
+
+#include "proc/spinlock.h"
+
+#include "util/debug.h"
+#include "util/init.h"
+#include "util/list.h"
+#include "util/time.h"
+#include "util/timer.h"
+
+/*
+ * Pending timers live on a hierarchical timer wheel. Level 0 has a slot
+ * for each of the next TIMER_WHEEL_SIZE ticks, and each slot of level n
+ * covers TIMER_WHEEL_SIZE times as many ticks as a slot of level n - 1.
+ * Adding and removing a timer is a list operation on the slot it falls
+ * in. Whenever level n - 1 wraps around, the next slot of level n is
+ * emptied and its timers are spread over the lower levels, so each
+ * timer is moved at most TIMER_WHEEL_LEVELS - 1 times before it fires
+ * and a tick only touches the timers which are due.
+ */
+#define TIMER_WHEEL_BITS        6
+#define TIMER_WHEEL_SIZE        (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK        (TIMER_WHEEL_SIZE - 1)
+#define TIMER_WHEEL_LEVELS      4
+/* Timers further out than this are parked in the last slot reachable and
+ * put back on the wheel when that slot comes up */
+#define TIMER_MAX_DELTA         ((1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1)
+
+static list_t timer_wheel[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SIZE];
+/* The next tick whose level 0 slot has not been run yet */
+static uint32_t timer_jiffies = 0;
+/* Protects the wheel and timer_jiffies */
+static spinlock_t timer_lock = SPINLOCK_INITIALIZER;
+
+static __attribute__((unused)) void
+timers_init(void)
+{
+        int level, slot;
+
+        for (level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+                for (slot = 0; slot < TIMER_WHEEL_SIZE; slot++) {
+                        list_init(&timer_wheel[level][slot]);
+                }
+        }
+        timer_jiffies = jiffies;
+}
+init_func(timers_init);
+
+/* Must be called with timer_lock held. */
+static void
+_timer_enqueue(timer_t *timer)
+{
+        uint32_t expires = timer->t_expires;
+        uint32_t delta = expires - timer_jiffies;
+        int level;
+
+        if ((int32_t)delta < 0) {
+                /* already due, run it on the next tick */
+                expires = timer_jiffies;
+                delta = 0;
+        } else if (delta > TIMER_MAX_DELTA) {
+                expires = timer_jiffies + TIMER_MAX_DELTA;
+                delta = TIMER_MAX_DELTA;
+        }
+
+        for (level = 0; level < TIMER_WHEEL_LEVELS - 1; level++) {
+                if (delta < (1U << (TIMER_WHEEL_BITS * (level + 1))))
+                        break;
+        }
+        list_insert_tail(&timer_wheel[level][(expires >> (TIMER_WHEEL_BITS * level))
+                                             & TIMER_WHEEL_MASK], &timer->t_link);
+}
+
+/*
+ * Moves the timers in the given slot down to the lower levels. Returns
+ * the slot so the caller knows whether this level wrapped around too.
+ */
+static int
+_timer_cascade(int level)
+{
+        int slot = (timer_jiffies >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+        list_t *list = &timer_wheel[level][slot];
+        timer_t *timer;
+
+        while (!list_empty(list)) {
+                timer = list_head(list, timer_t, t_link);
+                list_remove(&timer->t_link);
+                _timer_enqueue(timer);
+        }
+        return slot;
+}
+
+void
+timer_init(timer_t *timer, timer_func_t func, void *data)
+{
+        timer->t_func = func;
+        timer->t_data = data;
+        timer->t_expires = 0;
+        list_link_init(&timer->t_link);
+}
+
+void
+timer_add(timer_t *timer, uint32_t expires)
+{
+        KASSERT(!timer_pending(timer));
+        spinlock_lock(&timer_lock);
+        timer->t_expires = expires;
+        _timer_enqueue(timer);
+        spinlock_unlock(&timer_lock);
+}
+
+int
+timer_del(timer_t *timer)
+{
+        int pending;
+
+        spinlock_lock(&timer_lock);
+        pending = timer_pending(timer);
+        if (pending)
+                list_remove(&timer->t_link);
+        spinlock_unlock(&timer_lock);
+        return pending;
+}
+
+void
+timer_run(void)
+{
+        uint8_t ipl = intr_getipl();
+        list_t *list;
+        timer_t *timer;
+        uint32_t now;
+        int level;
+
+        /* callbacks run at IPL_HIGH, but without timer_lock, so that
+         * they can re-arm their timers */
+        intr_setipl(IPL_HIGH);
+        spinlock_lock(&timer_lock);
+        while ((int32_t)(jiffies - timer_jiffies) >= 0) {
+                if (0 == (timer_jiffies & TIMER_WHEEL_MASK)) {
+                        for (level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+                                if (0 != _timer_cascade(level))
+                                        break;
+                        }
+                }
+
+                now = timer_jiffies++;
+                list = &timer_wheel[0][now & TIMER_WHEEL_MASK];
+                /* a callback may re-arm its timer, which lands in a later slot */
+                while (!list_empty(list)) {
+                        timer = list_head(list, timer_t, t_link);
+                        list_remove(&timer->t_link);
+                        if ((int32_t)(timer->t_expires - now) > 0) {
+                                _timer_enqueue(timer);  /* was parked, not due */
+                        } else {
+                                spinlock_unlock(&timer_lock);
+                                timer->t_func(timer->t_data);
+                                spinlock_lock(&timer_lock);
+                        }
+                }
+        }
+        spinlock_unlock(&timer_lock);
+        intr_setipl(ipl);
+}
@@ -55,7 +55,7 @@ anon_init()
 	/*
         NOT_YET_IMPLEMENTED("VM: anon_init");
     */
-	anon_allocator = slab_allocator_create("anon", sizeof(mmobj_t));
+	anon_allocator = slab_allocator_create("anon", sizeof(mmobj_t), 0, NULL, NULL);
     KASSERT(anon_allocator);
     dbg(DBG_PRINT, "(GRADING3A 4.a)\n");
 }
@@ -165,7 +165,15 @@ anon_fillpage(mmobj_t *o, pframe_t *pf)
 	/* get the page from the given frame */
 	pframe_t *page = pframe_get_resident(pf->pf_obj,pf->pf_pagenum);
 	if(page) {
-		memcpy(pf->pf_addr, page->pf_addr, PAGE_SIZE);
+		/* anonymous memory starts out zeroed; trade the frame's page
+		 * for one the idle loop already zeroed when there is one */
+		void *zeroed = page_alloc_zeroed();
+		if(zeroed) {
+			page_free(pf->pf_addr);
+			pf->pf_addr = zeroed;
+		} else {
+			memset(pf->pf_addr, 0, PAGE_SIZE);
+		}
 		if(!pframe_is_pinned(page)) {
 			pframe_pin(page);
 		}
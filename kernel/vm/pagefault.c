@@ -99,7 +99,7 @@ handle_pagefault(uintptr_t vaddr, uint32_t cause)
 		} else { /* not sure what to do with FAULT_USER/ FAULT_PRESENT */
 			/*pframe_get(struct mmobj *o, uint32_t pagenum, pframe_t **result) */
 			pframe_t *new_frame = NULL;
-			uint32_t pagenum = (vaddr_vfn - vmarea->vma_start)/* + vmarea->vma_off*/;
+			uint32_t pagenum = vaddr_vfn - vmarea->vma_start + vmarea->vma_off;
 			if(pframe_get(vmarea->vma_obj, pagenum, &new_frame) >= 0) {
 				pframe_clear_busy(new_frame);
 				uintptr_t paddr = pt_virt_to_phys((uintptr_t)new_frame->pf_addr); /* gives the physical address */
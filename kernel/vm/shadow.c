@@ -68,7 +68,7 @@ shadow_init()
 	/*
         NOT_YET_IMPLEMENTED("VM: shadow_init");
     */
-	shadow_allocator = slab_allocator_create("shadow", sizeof(mmobj_t));
+	shadow_allocator = slab_allocator_create("shadow", sizeof(mmobj_t), 0, NULL, NULL);
     KASSERT(shadow_allocator);
     dbg(DBG_PRINT, "(GRADING3A 6.a)\n");
 }
@@ -84,8 +84,9 @@ shadowd(int arg1, void *arg2)
                                                 mmobj_t *shadow = o->mmo_shadowed;
                                                 /* iff the object has only one parent, and is not right under vm_area */
                                                 KASSERT(o != last);
+                                                int migrated = 1;
                                                 if (o->mmo_refcount - o->mmo_nrespages == 1) {
-                                                        /* migrate all its pages to last, and remove it from the shadow tree */
+                                                        /* migrate all its pages to last */
                                                         pframe_t *pf;
                                                         list_iterate_begin(&o->mmo_respages, pf, pframe_t, pf_olink) {
                                                                 /* Because the operations that could be
@@ -94,8 +95,12 @@ shadowd(int arg1, void *arg2)
                                                                  * we always expect to see non-busy pages. */
                                                                 KASSERT(!pframe_is_busy(pf));
                                                                 /* o has refcount 1+nrespages, so this won't delete it yet */
-                                                                pframe_migrate(pf, last);
+                                                                if (migrated && 0 > pframe_migrate(pf, last))
+                                                                        migrated = 0;
                                                         } list_iterate_end();
+                                                }
+                                                if (o->mmo_refcount - o->mmo_nrespages == 1 && migrated) {
+                                                        /* remove it from the shadow tree */
                                                         last->mmo_shadowed = o->mmo_shadowed;
                                                         /* Ref o's shadowed, so we don't accidentally delete it when we
                                                          * finally put o */
@@ -103,7 +108,9 @@ shadowd(int arg1, void *arg2)
                                                         KASSERT(o->mmo_refcount == 1 && o->mmo_nrespages == 0);
                                                         o->mmo_ops->put(o);
                                                 } else {
-                                                        KASSERT(o->mmo_refcount - o->mmo_nrespages == 2);
+                                                        /* out of memory partway through migrating
+                                                         * leaves o in place with its remaining pages */
+                                                        KASSERT(!migrated || o->mmo_refcount - o->mmo_nrespages == 2);
                                                         o->mmo_ops->ref(o);
                                                         last->mmo_ops->put(last);
                                                         last = o;
@@ -138,6 +145,7 @@ shadowd_init()
         shadowd_thr = kthread_create(shadowd_proc, shadowd, 0, NULL);
         KASSERT(NULL != shadowd_thr);
 
+        sched_set_priority(shadowd_thr, PRIO_DAEMON);
         sched_make_runnable(shadowd_thr);
 
         shadowd_initialized = 1;
@@ -41,9 +41,9 @@ static slab_allocator_t *vmmap_allocator;
 static slab_allocator_t *vmarea_allocator;
 
 void vmmap_init(void) {
-	vmmap_allocator = slab_allocator_create("vmmap", sizeof(vmmap_t));
+	vmmap_allocator = slab_allocator_create("vmmap", sizeof(vmmap_t), 0, NULL, NULL);
 	KASSERT(NULL != vmmap_allocator && "failed to create vmmap allocator!");
-	vmarea_allocator = slab_allocator_create("vmarea", sizeof(vmarea_t));
+	vmarea_allocator = slab_allocator_create("vmarea", sizeof(vmarea_t), 0, NULL, NULL);
 	KASSERT(NULL != vmarea_allocator && "failed to create vmarea allocator!");
 }
 
@@ -52,6 +52,9 @@ vmarea_alloc(void) {
 	vmarea_t *newvma = (vmarea_t *) slab_obj_alloc(vmarea_allocator);
 	if (newvma) {
 		newvma->vma_vmmap = NULL;
+		newvma->vma_obj = NULL;
+		newvma->vma_rleft = NULL;
+		newvma->vma_rright = NULL;
 	}
 	return newvma;
 }
@@ -61,6 +64,141 @@ void vmarea_free(vmarea_t *vma) {
 	slab_obj_free(vmarea_allocator, vma);
 }
 
+/*
+ * The reverse map of a bottom object is an interval tree over the pages
+ * [vma_off, vma_off + npages) of the object that its vm_areas map. It is
+ * a treap ordered by vma_off (ties broken by address), with heap
+ * priorities hashed from the vmarea's address so no extra state is
+ * needed, and each node caching the largest end in its subtree so that
+ * lookups skip subtrees which cannot contain the page.
+ */
+#define vmarea_rmap_end(vma) \
+	((vma)->vma_off + ((vma)->vma_end - (vma)->vma_start))
+#define vmarea_rmap_prio(vma) ((uint32_t) (uintptr_t) (vma) * 2654435761U)
+#define vmarea_rmap_before(a, b) \
+	((a)->vma_off < (b)->vma_off || ((a)->vma_off == (b)->vma_off && (a) < (b)))
+
+static void vmarea_rmap_update(vmarea_t *vma) {
+	uint32_t max = vmarea_rmap_end(vma);
+	if (NULL != vma->vma_rleft && vma->vma_rleft->vma_rmax > max) {
+		max = vma->vma_rleft->vma_rmax;
+	}
+	if (NULL != vma->vma_rright && vma->vma_rright->vma_rmax > max) {
+		max = vma->vma_rright->vma_rmax;
+	}
+	vma->vma_rmax = max;
+}
+
+static vmarea_t *vmarea_rmap_rotate_right(vmarea_t *vma) {
+	vmarea_t *left = vma->vma_rleft;
+	vma->vma_rleft = left->vma_rright;
+	left->vma_rright = vma;
+	vmarea_rmap_update(vma);
+	vmarea_rmap_update(left);
+	return left;
+}
+
+static vmarea_t *vmarea_rmap_rotate_left(vmarea_t *vma) {
+	vmarea_t *right = vma->vma_rright;
+	vma->vma_rright = right->vma_rleft;
+	right->vma_rleft = vma;
+	vmarea_rmap_update(vma);
+	vmarea_rmap_update(right);
+	return right;
+}
+
+static vmarea_t *vmarea_rmap_insert_at(vmarea_t *root, vmarea_t *vma) {
+	if (NULL == root) {
+		return vma;
+	}
+	if (vmarea_rmap_before(vma, root)) {
+		root->vma_rleft = vmarea_rmap_insert_at(root->vma_rleft, vma);
+		if (vmarea_rmap_prio(root->vma_rleft) > vmarea_rmap_prio(root)) {
+			return vmarea_rmap_rotate_right(root);
+		}
+	} else {
+		root->vma_rright = vmarea_rmap_insert_at(root->vma_rright, vma);
+		if (vmarea_rmap_prio(root->vma_rright) > vmarea_rmap_prio(root)) {
+			return vmarea_rmap_rotate_left(root);
+		}
+	}
+	vmarea_rmap_update(root);
+	return root;
+}
+
+static vmarea_t *vmarea_rmap_remove_at(vmarea_t *root, vmarea_t *vma) {
+	KASSERT(NULL != root && "vmarea missing from its reverse map");
+	if (root == vma) {
+		if (NULL == root->vma_rleft) {
+			return root->vma_rright;
+		}
+		if (NULL == root->vma_rright) {
+			return root->vma_rleft;
+		}
+		/* rotate the area down below its higher priority child */
+		if (vmarea_rmap_prio(root->vma_rleft) > vmarea_rmap_prio(root->vma_rright)) {
+			root = vmarea_rmap_rotate_right(root);
+			root->vma_rright = vmarea_rmap_remove_at(root->vma_rright, vma);
+		} else {
+			root = vmarea_rmap_rotate_left(root);
+			root->vma_rleft = vmarea_rmap_remove_at(root->vma_rleft, vma);
+		}
+	} else if (vmarea_rmap_before(vma, root)) {
+		root->vma_rleft = vmarea_rmap_remove_at(root->vma_rleft, vma);
+	} else {
+		root->vma_rright = vmarea_rmap_remove_at(root->vma_rright, vma);
+	}
+	vmarea_rmap_update(root);
+	return root;
+}
+
+/* Adds an area to the reverse map of the bottom object of its vma_obj.
+ * Must be called once vma_obj and the area's range are final, and the
+ * area removed again before either changes. */
+void vmarea_rmap_insert(vmarea_t *vma) {
+	KASSERT(NULL != vma && NULL != vma->vma_obj);
+	vmarea_t **root = mmobj_bottom_vmas(vma->vma_obj);
+
+	vma->vma_rleft = NULL;
+	vma->vma_rright = NULL;
+	vma->vma_rmax = vmarea_rmap_end(vma);
+	*root = vmarea_rmap_insert_at(*root, vma);
+}
+
+void vmarea_rmap_remove(vmarea_t *vma) {
+	KASSERT(NULL != vma);
+	if (NULL == vma->vma_obj) {
+		return; /* never mapped anything, so never inserted */
+	}
+	vmarea_t **root = mmobj_bottom_vmas(vma->vma_obj);
+
+	*root = vmarea_rmap_remove_at(*root, vma);
+	vma->vma_rleft = NULL;
+	vma->vma_rright = NULL;
+}
+
+static void vmarea_rmap_stab(vmarea_t *root, uint32_t pagenum,
+		vmarea_rmap_func_t func, void *arg) {
+	while (NULL != root && root->vma_rmax > pagenum) {
+		vmarea_rmap_stab(root->vma_rleft, pagenum, func, arg);
+		if (root->vma_off > pagenum) {
+			return; /* everything to the right starts even later */
+		}
+		if (pagenum < vmarea_rmap_end(root)) {
+			func(root, root->vma_start + pagenum - root->vma_off, arg);
+		}
+		root = root->vma_rright;
+	}
+}
+
+/* Calls func on every vm_area which maps page pagenum of the bottom
+ * object of o, visiting only the areas containing it and the tree nodes
+ * on the way to them. func must not change the reverse map. */
+void vmarea_rmap_iterate(mmobj_t *o, uint32_t pagenum,
+		vmarea_rmap_func_t func, void *arg) {
+	vmarea_rmap_stab(*mmobj_bottom_vmas(o), pagenum, func, arg);
+}
+
 /* a debugging routine: dumps the mappings of the given address space. */
 size_t vmmap_mapping_info(const void *vmmap, char *buf, size_t osize) {
 	KASSERT(0 < osize);
@@ -140,6 +278,7 @@ void vmmap_destroy(vmmap_t *map) {
 				vput(v);
 			}
 		}
+		vmarea_rmap_remove(area);
 		area->vma_obj->mmo_ops->put(area->vma_obj); /* decrement the reference */
 		list_remove(link);
 		vmarea_free(area);
@@ -278,7 +417,8 @@ vmmap_lookup(vmmap_t *map, uint32_t vfn) {
 /* Allocates a new vmmap containing a new vmarea for each area in the
  * given map. The areas should have no mmobjs set yet. Returns pointer
  * to the new vmmap on success, NULL on failure. This function is
- * called when implementing fork(2). */
+ * called when implementing fork(2). Once the caller gives an area its
+ * mmobj it must also add it to the reverse map with vmarea_rmap_insert. */
 vmmap_t *
 vmmap_clone(vmmap_t *map) {
 	/*NOT_YET_IMPLEMENTED("VM: vmmap_clone");*/
@@ -352,7 +492,7 @@ int vmmap_map(vmmap_t *map, vnode_t *file, uint32_t lopage, uint32_t npages,
 	if(!new_area) {
 		return -1;
 	}
-	new_area->vma_off = off;
+	new_area->vma_off = ADDR_TO_PN(off);
 	new_area->vma_flags = flags;
 	new_area->vma_prot = prot;
 
@@ -388,6 +528,9 @@ int vmmap_map(vmmap_t *map, vnode_t *file, uint32_t lopage, uint32_t npages,
 				new_area->vma_obj =  new_mmobj;
 			}
 		}
+		if (NULL != new_area->vma_obj) {
+			vmarea_rmap_insert(new_area);
+		}
 		new_area->vma_vmmap = map;
 		new = &new_area;
 		return 0;
@@ -420,6 +563,9 @@ int vmmap_map(vmmap_t *map, vnode_t *file, uint32_t lopage, uint32_t npages,
 					new_area->vma_obj =  new_mmobj;
 				}
 			}
+			if (NULL != new_area->vma_obj) {
+				vmarea_rmap_insert(new_area);
+			}
 			new_area->vma_vmmap = map;
 			new = &new_area;
 			return 0;
@@ -454,6 +600,9 @@ int vmmap_map(vmmap_t *map, vnode_t *file, uint32_t lopage, uint32_t npages,
 					new_area->vma_obj =  new_mmobj;
 				}
 			}
+			if (NULL != new_area->vma_obj) {
+				vmarea_rmap_insert(new_area);
+			}
 			new_area->vma_vmmap = map;
 			new = &new_area;
 			return 0;
@@ -501,21 +650,25 @@ int vmmap_remove(vmmap_t *map, uint32_t lopage, uint32_t npages) {
 		uint32_t lopage_end = lopage + npages;
 		/*case 2:*/
 		if (vmarea_start < lopage && vmarea_end < lopage_end) {
+			vmarea_rmap_remove(area);
 			area->vma_end = lopage_end;
+			vmarea_rmap_insert(area);
 			return 0;
 		}
 		/*case 4*/
 		if (lopage <= vmarea_start && lopage_end >= vmarea_end) {
 			list_remove(&area->vma_plink);
-			/*list_remove(&area->vma_olink);*/
+			vmarea_rmap_remove(area);
 			vmarea_free(area);
 			return 0;
 		}
 		/*case 3*/
 		if (lopage < vmarea_start && lopage_end < vmarea_end) {
+			vmarea_rmap_remove(area);
 			area->vma_start = lopage_end;
 			uint32_t old_offset = area->vma_off;
 			area->vma_off = old_offset + (lopage_end - vmarea_start);
+			vmarea_rmap_insert(area);
 			return 0;
 		}
 		/*case 1*/
@@ -531,8 +684,8 @@ int vmmap_remove(vmmap_t *map, uint32_t lopage, uint32_t npages) {
 			l_area->vma_obj = area->vma_obj;
 			l_area->vma_prot = area->vma_prot;
 			l_area->vma_vmmap = map;
-			vmmap_insert(map, l_area); /*that takes care of plink, and what do we do with olink*/
-			list_insert_before(&(area->vma_olink), &(l_area->vma_olink));
+			vmmap_insert(map, l_area); /*that takes care of plink*/
+			vmarea_rmap_insert(l_area);
 			/*do the same for the r_area*/
 			r_area->vma_start = lopage_end;
 			r_area->vma_end = vmarea_end;
@@ -541,13 +694,13 @@ int vmmap_remove(vmmap_t *map, uint32_t lopage, uint32_t npages) {
 			r_area->vma_obj = area->vma_obj;
 			r_area->vma_prot = area->vma_prot;
 			r_area->vma_vmmap = map;
-			vmmap_insert(map, r_area); /*that takes care of plink, and what do we do with olink*/
-			list_insert_before((&(area->vma_olink))->l_next, &(r_area->vma_olink));
+			vmmap_insert(map, r_area); /*that takes care of plink*/
+			vmarea_rmap_insert(r_area);
 			/*increment the ref count on mmobj:*/
 			area->vma_obj->mmo_ops->ref(area->vma_obj);
 			/*remove and deallocate the old vmarea*/
 			list_remove(&area->vma_plink);
-			list_remove(&area->vma_olink);
+			vmarea_rmap_remove(area);
 			vmarea_free(area);
 			return 0;
 		}
@@ -624,11 +777,15 @@ int vmmap_read(vmmap_t *map, const void *vaddr, void *buf, size_t count) {
 	}
 	/*look up the page*/
 	struct mmobj *memobj = area->vma_obj;
-	int pagenum = vfn - (area->vma_start); /*pagenum based on the vfn of the vaddr*/
+	int pagenum = vfn - (area->vma_start) + (area->vma_off); /*pagenum based on the vfn of the vaddr*/
 	pframe_t* pg_frame = NULL;
 	int read_count = 0;
 	uint32_t offset = PAGE_OFFSET(addr);/*(addr << 20) >> 20;*//*get the offset in the physical page*/
 	uint32_t rem_count = count;
+	/* start reading all of the file pages we are about to need at once */
+	if (count > 0)
+		pframe_prefetch(mmobj_bottom_obj(memobj), pagenum,
+		                MIN(ADDR_TO_PN(addr + count - 1) + 1, area->vma_end) - vfn);
 	while (rem_count > 0) {
 
 		int result = pframe_get(memobj, pagenum, &pg_frame);
@@ -665,7 +822,7 @@ int vmmap_write(vmmap_t *map, void *vaddr, const void *buf, size_t count) {
 	uint32_t vfn = ADDR_TO_PN(addr);
 	vmarea_t *area = vmmap_lookup(map, vfn); /* look up the vmarea vaddr belongs to*/
 	/*look up the page*/
-	int pagenum = vfn - (area->vma_start)/* + (area->vma_off)*/; /*pagenum based on the vfn of the vaddr*/
+	int pagenum = vfn - (area->vma_start) + (area->vma_off); /*pagenum based on the vfn of the vaddr*/
 	struct mmobj *memobj = area->vma_obj;
 	pframe_t* pg_frame = NULL;
 	int write_count = 0;
@@ -22,7 +22,7 @@ class Slab:
 			self._value = val.cast(_slab_type)
 
 	def objs(self, typ=None):
-		next = self._value["s_addr"]
+		next = self._value["s_objs"]
 		for i in xrange(self._alloc["sa_slab_nobjs"]):
 			bufctl = (next.cast(_uintptr_type)
 					  + self._alloc["sa_objsize"]).cast(_bufctl_type.pointer())
@@ -57,10 +57,9 @@ class SlabAllocator:
 		return int(self._value["sa_objsize"])
 
 	def slabs(self):
-		next = self._value["sa_slabs"]
-		while (next != 0):
-			yield Slab(self._value, next.dereference())
-			next = next.dereference()["s_next"]
+		for name in ["sa_partial", "sa_full", "sa_empty"]:
+			for link in weenix.list.load(self._value[name], "struct slab", "s_link"):
+				yield Slab(self._value, link.item())
 
 	def objs(self, typ=None):
 		for slab in self.slabs():
@@ -91,13 +90,7 @@ def pagesize():
 
 def freepages():
 	freepages = dict()
-	for pagegroup in weenix.list.load("pagegroup_list", "struct pagegroup", "pg_link"):
-		freelist = pagegroup.item()["pg_freelist"]
-		for order in xrange(freelist.type.sizeof / freelist.type.target().sizeof):
-			psize = (1 << order) * PAGE_SIZE
-			count = len(weenix.list.load(freelist[order]))
-			if (order in freepages):
-				freepages[order] += count
-			else:
-				freepages[order] = count
+	freelist = gdb.parse_and_eval("page_freelist")
+	for order in xrange(freelist.type.sizeof / freelist.type.target().sizeof):
+		freepages[order] = len(weenix.list.load(freelist[order]))
 	return freepages
@@ -31,6 +31,7 @@ int     thr_errno(void);
 void    thr_set_errno(int n);
 void    yield(void);
 pid_t   getpid(void);
+unsigned int sleep(unsigned int seconds);
 int     halt(void);
 void    sync(void);
 
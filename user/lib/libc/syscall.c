@@ -130,6 +130,14 @@ pid_t getpid(void)
         return trap(SYS_getpid, 0);
 }
 
+unsigned int sleep(unsigned int seconds)
+{
+        /* the kernel counts in milliseconds and tells us how many were
+         * left if the sleep was cut short */
+        int left = trap(SYS_sleep, (uint32_t) seconds * 1000);
+        return (left > 0) ? ((unsigned int) left + 999) / 1000 : 0;
+}
+
 int halt(void)
 {
         return trap(SYS_halt, 0);